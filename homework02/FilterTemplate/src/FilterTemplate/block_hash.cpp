@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#include "block_hash.hpp"
+
+namespace {
+
+/// Base of the polynomial over the pixels of a row
+constexpr uint32_t ROW_BASE = 0x01000193u;
+
+/// Base of the polynomial over the row hashes of a block
+constexpr uint32_t COLUMN_BASE = 0x9E3779B1u;
+
+/// base to the power of BLOCK_SIZE - 1, the weight of the first term
+uint32_t FirstWeight(uint32_t base) {
+	uint32_t weight = 1;
+	for (int i = 1; i < BlockHashMatcher::BLOCK_SIZE; ++i)
+		weight *= base;
+
+	return weight;
+}
+
+/// Distance between two positions
+inline int Distance(const BlockHashMatcher::Position& a, int row, int col) {
+	return std::abs(a.row - row) + std::abs(a.col - col);
+}
+
+/// Orderings of positions sorted in raster order, for binary searches
+inline bool RowLess(const BlockHashMatcher::Position& a, int row) {
+	return a.row < row;
+}
+
+inline bool RowGreater(int row, const BlockHashMatcher::Position& a) {
+	return row < a.row;
+}
+
+inline bool ColumnLess(const BlockHashMatcher::Position& a, int col) {
+	return a.col < col;
+}
+
+}
+
+BlockHashMatcher::BlockHashMatcher(int width, int height, int blocks_hor, int blocks_vert)
+	: width(width)
+	, height(height)
+	, blocks_hor(blocks_hor)
+	, blocks_vert(blocks_vert)
+	, slot_mask(1)
+	, filter((1 << FILTER_BITS) / 64)
+	, block_groups(blocks_hor * blocks_vert)
+	, row_hashes(std::make_unique<uint32_t[]>(BLOCK_SIZE * (width - BLOCK_SIZE + 1)))
+	, column_hashes(std::make_unique<uint32_t[]>(width - BLOCK_SIZE + 1)) {
+	// At most half of the slots are used, so lookups of absent hashes end quickly.
+	while (slot_mask + 1 < static_cast<uint32_t>(2 * blocks_hor * blocks_vert))
+		slot_mask = 2 * slot_mask + 1;
+
+	slots.resize(slot_mask + 1);
+	groups.reserve(blocks_hor * blocks_vert);
+}
+
+uint32_t BlockHashMatcher::Hash(const uint8_t* block, int stride) {
+	uint32_t hash = 0;
+
+	for (int y = 0; y < BLOCK_SIZE; ++y) {
+		uint32_t row_hash = 0;
+		for (int x = 0; x < BLOCK_SIZE; ++x)
+			row_hash = row_hash * ROW_BASE + block[y * stride + x];
+
+		hash = hash * COLUMN_BASE + row_hash;
+	}
+
+	return hash;
+}
+
+void BlockHashMatcher::AddMatch(Position* nearest, int& count, const Position& position, int row, int col) {
+	const auto distance = Distance(position, row, col);
+
+	if (count == MAX_MATCHES && distance >= Distance(nearest[MAX_MATCHES - 1], row, col))
+		return;
+
+	int i = (count < MAX_MATCHES) ? count++ : MAX_MATCHES - 1;
+	for (; i > 0 && Distance(nearest[i - 1], row, col) > distance; --i)
+		nearest[i] = nearest[i - 1];
+
+	nearest[i] = position;
+}
+
+void BlockHashMatcher::Find(const uint8_t* cur, const uint8_t* ref, int first_row, int first_col) {
+	std::fill(slots.begin(), slots.end(), 0);
+	std::fill(filter.begin(), filter.end(), 0);
+	groups.clear();
+	hits.clear();
+
+	// Blocks with the same hash form a group, found by linear probing.
+	for (int i = 0; i < blocks_vert; ++i) {
+		for (int j = 0; j < blocks_hor; ++j) {
+			const auto row = first_row + i * BLOCK_SIZE;
+			const auto col = first_col + j * BLOCK_SIZE;
+			const auto hash = Hash(cur + row * width + col, width);
+
+			auto slot = GetSlot(hash);
+			while (slots[slot] && groups[slots[slot] - 1].hash != hash)
+				slot = (slot + 1) & slot_mask;
+
+			if (!slots[slot]) {
+				Group group;
+				group.hash = hash;
+				group.begin = 0;
+				group.count = 0;
+
+				groups.push_back(group);
+				slots[slot] = static_cast<int>(groups.size());
+			}
+
+			block_groups[i * blocks_hor + j] = slots[slot] - 1;
+
+			const auto bit = GetFilterBit(hash);
+			filter[bit / 64] |= uint64_t(1) << (bit % 64);
+		}
+	}
+
+	const auto positions_hor = width - BLOCK_SIZE + 1;
+	const auto row_weight = FirstWeight(ROW_BASE);
+	const auto column_weight = FirstWeight(COLUMN_BASE);
+
+	std::fill(column_hashes.get(), column_hashes.get() + positions_hor, 0u);
+
+	// Going down the reference, the hash of a row of BLOCK_SIZE pixels slides
+	// along the row, and the hash of a block slides down its column: the
+	// oldest row leaves it and the new one enters.
+	for (int y = 0; y < height; ++y) {
+		const auto* src = ref + y * width;
+		auto* ring = row_hashes.get() + (y % BLOCK_SIZE) * positions_hor;
+		const auto full = y >= BLOCK_SIZE;
+
+		uint32_t row_hash = 0;
+		for (int x = 0; x < BLOCK_SIZE; ++x)
+			row_hash = row_hash * ROW_BASE + src[x];
+
+		for (int x = 0; x < positions_hor; ++x) {
+			if (x > 0)
+				row_hash = (row_hash - src[x - 1] * row_weight) * ROW_BASE + src[x + BLOCK_SIZE - 1];
+
+			auto column_hash = column_hashes[x];
+			if (full)
+				column_hash -= ring[x] * column_weight;
+
+			column_hash = column_hash * COLUMN_BASE + row_hash;
+			column_hashes[x] = column_hash;
+			ring[x] = row_hash;
+		}
+
+		if (y < BLOCK_SIZE - 1)
+			continue;
+
+		const auto row = y - BLOCK_SIZE + 1;
+
+		for (int x = 0; x < positions_hor; ++x) {
+			const auto hash = column_hashes[x];
+			const auto bit = GetFilterBit(hash);
+
+			if (!(filter[bit / 64] & (uint64_t(1) << (bit % 64))))
+				continue;
+
+			for (auto slot = GetSlot(hash); slots[slot]; slot = (slot + 1) & slot_mask) {
+				auto& group = groups[slots[slot] - 1];
+
+				if (group.hash == hash) {
+					++group.count;
+					hits.push_back({ slots[slot] - 1, { row, x } });
+					break;
+				}
+			}
+		}
+	}
+
+	// Bucket the positions by group. Scan order keeps each group in raster order.
+	int begin = 0;
+	for (auto& group : groups) {
+		group.begin = begin;
+		begin += group.count;
+		group.count = 0;
+	}
+
+	positions.resize(hits.size());
+	for (const auto& hit : hits) {
+		auto& group = groups[hit.group];
+		positions[group.begin + group.count++] = hit.position;
+	}
+}
+
+int BlockHashMatcher::GetMatches(int block, int row, int col, Position* nearest) const {
+	const auto& group = groups[block_groups[block]];
+	const auto begin = positions.data() + group.begin;
+	const auto end = begin + group.count;
+	int count = 0;
+
+	// The rows of the group are visited outwards from the given row until they
+	// are farther than the farthest of the nearest positions.
+	auto below = std::lower_bound(begin, end, row, RowLess);
+	auto above = below;
+
+	while (below != end || above != begin) {
+		const auto below_distance = (below != end) ? below->row - row : std::numeric_limits<int>::max();
+		const auto above_distance = (above != begin) ? row - (above - 1)->row : std::numeric_limits<int>::max();
+		const auto row_distance = std::min(below_distance, above_distance);
+
+		if (count == MAX_MATCHES && row_distance >= Distance(nearest[MAX_MATCHES - 1], row, col))
+			break;
+
+		const Position* first;
+		const Position* last;
+
+		if (below_distance <= above_distance) {
+			first = below;
+			last = std::upper_bound(below, end, below->row, RowGreater);
+			below = last;
+		} else {
+			last = above;
+			first = std::lower_bound(begin, above, (above - 1)->row, RowLess);
+			above = first;
+		}
+
+		// Outwards from the column along the row
+		const auto middle = std::lower_bound(first, last, col, ColumnLess);
+
+		for (auto p = middle; p != last; ++p) {
+			if (count == MAX_MATCHES && row_distance + p->col - col >= Distance(nearest[MAX_MATCHES - 1], row, col))
+				break;
+
+			AddMatch(nearest, count, *p, row, col);
+		}
+
+		for (auto p = middle; p != first; --p) {
+			if (count == MAX_MATCHES && row_distance + col - (p - 1)->col >= Distance(nearest[MAX_MATCHES - 1], row, col))
+				break;
+
+			AddMatch(nearest, count, *(p - 1), row, col);
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// Copies of the blocks of a frame anywhere in a reference frame, found by hash.
+/// The hashes of the blocks go into a small table. A two-dimensional rolling
+/// hash then visits every block position of the reference in one pass and
+/// looks itself up in the table, so the cost does not depend on how far the
+/// copies are. All positions found are kept, and each block asks for the
+/// ones nearest to where it is expected to have moved.
+class BlockHashMatcher {
+public:
+	/// Size of the hashed blocks
+	static constexpr int BLOCK_SIZE = 16;
+
+	/// Most positions returned for a block
+	static constexpr int MAX_MATCHES = 8;
+
+	/// A block position in a plane
+	struct Position {
+		int row;
+		int col;
+	};
+
+	/**
+	 * Constructor
+	 *
+	 * @param[in] width plane width, at least BLOCK_SIZE
+	 * @param[in] height plane height, at least BLOCK_SIZE
+	 * @param[in] blocks_hor number of blocks per row of the grid
+	 * @param[in] blocks_vert number of blocks per column of the grid
+	 */
+	BlockHashMatcher(int width, int height, int blocks_hor, int blocks_vert);
+
+	/**
+	 * Find the positions of the reference plane with the hash of each block
+	 * of the grid of the current plane
+	 *
+	 * @param[in] cur current plane, with a row stride of width
+	 * @param[in] ref reference plane, with a row stride of width
+	 * @param[in] first_row row of the first block of the grid
+	 * @param[in] first_col column of the first block of the grid
+	 */
+	void Find(const uint8_t* cur, const uint8_t* ref, int first_row, int first_col);
+
+	/**
+	 * Positions of the reference plane with the hash of a block nearest to
+	 * a given position, nearest first
+	 *
+	 * Repeated content has many copies, and the one the block moved with is
+	 * near where its neighbours say it went, so the caller passes that
+	 * position. Different blocks may share a hash, so the positions still
+	 * have to be compared with the block.
+	 *
+	 * @param[in] block block index in raster order
+	 * @param[in] row row the positions should be near
+	 * @param[in] col column the positions should be near
+	 * @param[out] nearest array of MAX_MATCHES positions
+	 * @return number of positions
+	 */
+	int GetMatches(int block, int row, int col, Position* nearest) const;
+
+	/// Hash of a block, equal to that of its copies
+	static uint32_t Hash(const uint8_t* block, int stride);
+
+private:
+	/// log2 of the number of bits in the filter
+	static constexpr int FILTER_BITS = 20;
+
+	/// Blocks with the same hash and the positions found for them
+	struct Group {
+		uint32_t hash;
+
+		/// Index of the first position of the group in positions
+		int begin;
+
+		/// Number of positions found
+		int count;
+	};
+
+	/// A position of the reference with the hash of a group
+	struct Hit {
+		int group;
+		Position position;
+	};
+
+	/// Slot of a hash in the table
+	inline uint32_t GetSlot(uint32_t hash) const {
+		// The finalizer of MurmurHash3 spreads all bits of the hash into the low ones.
+		hash ^= hash >> 16;
+		hash *= 0x85EBCA6Bu;
+		hash ^= hash >> 13;
+		hash *= 0xC2B2AE35u;
+		hash ^= hash >> 16;
+		return hash & slot_mask;
+	}
+
+	/// Bit of a hash in the filter
+	static inline uint32_t GetFilterBit(uint32_t hash) {
+		return (hash * 0x9E3779B1u) >> (32 - FILTER_BITS);
+	}
+
+	/// Keep a position among the nearest ones to (row, col), sorted by distance
+	static void AddMatch(Position* nearest, int& count, const Position& position, int row, int col);
+
+	/// Plane width
+	const int width;
+
+	/// Plane height
+	const int height;
+
+	/// Number of blocks per row of the grid
+	const int blocks_hor;
+
+	/// Number of blocks per column of the grid
+	const int blocks_vert;
+
+	/// Number of table slots minus one, a power of two minus one
+	uint32_t slot_mask;
+
+	/// Group index plus one by slot, 0 for empty slots
+	std::vector<int> slots;
+
+	/// Bits set for the hashes in the table. Most positions of the reference
+	/// match no block, and a clear bit rules them out without a probe.
+	std::vector<uint64_t> filter;
+
+	/// Groups of the current frame
+	std::vector<Group> groups;
+
+	/// Group of every block
+	std::vector<int> block_groups;
+
+	/// Positions found in the reference, in scan order
+	std::vector<Hit> hits;
+
+	/// Positions found in the reference by group, each group in raster order
+	std::vector<Position> positions;
+
+	/// Row hashes of the last BLOCK_SIZE rows of the reference, by row modulo BLOCK_SIZE
+	std::unique_ptr<uint32_t[]> row_hashes;
+
+	/// Hashes of the blocks ending on the current row of the reference
+	std::unique_ptr<uint32_t[]> column_hashes;
+};
@@ -0,0 +1,65 @@
+#include "cpu.hpp"
+
+#if defined(ME_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(ME_X86)
+static void Cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+	for (int i = 0; i < 4; ++i)
+		regs[i] = static_cast<unsigned>(r[i]);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long Xgetbv() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+static CpuFeatures DetectCpuFeatures() {
+	CpuFeatures features = {};
+
+#if defined(ME_X86)
+	unsigned regs[4];
+	Cpuid(0, 0, regs);
+	const auto max_leaf = regs[0];
+
+	if (max_leaf >= 1) {
+		Cpuid(1, 0, regs);
+		features.sse2 = (regs[3] & (1u << 26)) != 0;
+		features.sse41 = (regs[2] & (1u << 19)) != 0;
+
+		// AVX state must be enabled by the OS, otherwise ymm registers are not preserved.
+		const bool osxsave = (regs[2] & (1u << 27)) != 0;
+		const bool avx = (regs[2] & (1u << 28)) != 0;
+		const bool ymm_enabled = osxsave && avx && (Xgetbv() & 0x6) == 0x6;
+
+		if (max_leaf >= 7 && ymm_enabled) {
+			Cpuid(7, 0, regs);
+			features.avx2 = (regs[1] & (1u << 5)) != 0;
+		}
+	}
+#endif
+
+	return features;
+}
+
+const CpuFeatures& GetCpuFeatures() {
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
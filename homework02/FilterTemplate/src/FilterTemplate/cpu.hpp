@@ -0,0 +1,27 @@
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define ME_X86 1
+#endif
+
+/// Mark a function as allowed to use the given instruction set.
+/// MSVC accepts intrinsics for any instruction set without extra flags.
+#if defined(ME_X86) && !defined(_MSC_VER)
+#define ME_TARGET_SSE2 __attribute__((target("sse2")))
+#define ME_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define ME_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ME_TARGET_SSE2
+#define ME_TARGET_SSE41
+#define ME_TARGET_AVX2
+#endif
+
+/// Instruction set extensions available on the host CPU
+struct CpuFeatures {
+	bool sse2;
+	bool sse41;
+	bool avx2;
+};
+
+/// Query the host CPU. The result is computed on the first call and cached.
+const CpuFeatures& GetCpuFeatures();
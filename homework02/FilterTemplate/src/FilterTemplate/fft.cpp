@@ -0,0 +1,69 @@
+#include <cmath>
+#include <utility>
+
+#include "fft.hpp"
+
+namespace {
+
+/// Product of two complex numbers, without the checks for infinities of the
+/// standard operator that keep it from being inlined
+inline FFT::Complex Multiply(FFT::Complex a, FFT::Complex b) {
+	return FFT::Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+}
+
+FFT::FFT(int size)
+	: size(size)
+	, reversed(size)
+	, twiddles(size / 2) {
+	int bits = 0;
+	while ((1 << bits) < size)
+		++bits;
+
+	for (int i = 0; i < size; ++i) {
+		int r = 0;
+		for (int b = 0; b < bits; ++b)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+
+		reversed[i] = r;
+	}
+
+	const auto pi = std::acos(-1.0);
+
+	for (int k = 0; k < size / 2; ++k)
+		twiddles[k] = Complex(static_cast<float>(std::cos(2 * pi * k / size)),
+		                      static_cast<float>(-std::sin(2 * pi * k / size)));
+}
+
+void FFT::Transform(Complex* data, int step, bool inverse) const {
+	for (int i = 0; i < size; ++i) {
+		if (i < reversed[i])
+			std::swap(data[i * step], data[reversed[i] * step]);
+	}
+
+	// Butterflies of growing span; the inverse transform uses conjugate twiddles.
+	for (int span = 1; span < size; span *= 2) {
+		const auto twiddle_step = size / (2 * span);
+
+		for (int start = 0; start < size; start += 2 * span) {
+			for (int k = 0; k < span; ++k) {
+				const auto& w = twiddles[k * twiddle_step];
+				auto& a = data[(start + k) * step];
+				auto& b = data[(start + k + span) * step];
+
+				const auto t = Multiply(b, inverse ? std::conj(w) : w);
+				b = a - t;
+				a += t;
+			}
+		}
+	}
+}
+
+void FFT::Transform2D(Complex* data, bool inverse) const {
+	for (int row = 0; row < size; ++row)
+		Transform(data + row * size, 1, inverse);
+
+	for (int col = 0; col < size; ++col)
+		Transform(data + col, size, inverse);
+}
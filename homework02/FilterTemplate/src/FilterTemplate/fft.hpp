@@ -0,0 +1,41 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+/// Radix-2 fast Fourier transform of square power-of-two arrays
+class FFT {
+public:
+	using Complex = std::complex<float>;
+
+	/// Constructor, precomputes the twiddle factors for size x size arrays
+	/// @param[in] size array side, a power of two
+	explicit FFT(int size);
+
+	/// Array side
+	inline int Size() const {
+		return size;
+	}
+
+	/**
+	 * Transform a size x size array in place, rows first, then columns
+	 *
+	 * @param[in,out] data array in row-major order
+	 * @param[in] inverse whether to compute the inverse transform. It is not
+	 *   normalized, so a forward and an inverse transform scale by size * size.
+	 */
+	void Transform2D(Complex* data, bool inverse) const;
+
+private:
+	/// Transform size values that are step apart in place
+	void Transform(Complex* data, int step, bool inverse) const;
+
+	/// Array side
+	const int size;
+
+	/// Index with its bits reversed, for the initial permutation
+	std::vector<int> reversed;
+
+	/// exp(-2 pi i k / size) for k < size / 2
+	std::vector<Complex> twiddles;
+};
@@ -12,11 +12,13 @@
 #include <fstream>
 #include <memory>
 #include <ratio>
+#include <vector>
 
 #include "half_pixel.hpp"
 #include "mv.hpp"
 #include "motion_estimator.hpp"
 #include "resource.h"
+#include "subpel.hpp"
 
 namespace chrono = std::chrono;
 using std::make_unique;
@@ -26,6 +28,7 @@ using std::min;
 using std::ofstream;
 using std::round;
 using std::unique_ptr;
+using std::vector;
 
 extern int g_VFVAPIVersion;
 
@@ -68,6 +71,16 @@ inline static double PSNR(double MSE, sint32 w, sint32 h) {
 	return 10 * log10(w * h * 255.0 * 255.0 / MSE);
 }
 
+template<typename T>
+inline static unique_ptr<T[]> CloneArray(const unique_ptr<T[]>& src, size_t count) {
+	if (!src)
+		return nullptr;
+
+	auto dst = make_unique<T[]>(count);
+	memcpy(dst.get(), src.get(), count * sizeof(T));
+	return dst;
+}
+
 enum class OutputType : int {
 	SOURCE,
 	RESIDUAL_BEFORE_MC,
@@ -75,6 +88,12 @@ enum class OutputType : int {
 	COMPENSATED
 };
 
+enum class Prediction : int {
+	BACKWARD,
+	FORWARD,
+	AVERAGE
+};
+
 struct FilterTemplateConfig {
 	OutputType output_type;
 	bool show_vectors;
@@ -82,6 +101,11 @@ struct FilterTemplateConfig {
 	bool measure_psnr;
 	uint8 quality;
 	bool use_half_pixel;
+	int num_threads;
+	int num_references;
+	bool bidirectional;
+	bool hash_matching;
+	int search_range;
 
 	FilterTemplateConfig()
 		: output_type(OutputType::SOURCE)
@@ -89,10 +113,55 @@ struct FilterTemplateConfig {
 		, draw_nothing(false)
 		, measure_psnr(false)
 		, quality(100)
-		, use_half_pixel(false) {
+		, use_half_pixel(false)
+		, num_threads(0)
+		, num_references(1)
+		, bidirectional(false)
+		, hash_matching(false)
+		, search_range(MotionEstimator::DEFAULT_SEARCH_RANGE) {
 	}
 };
 
+// A previous frame with its half-pixel shifted planes
+struct ReferenceFrame {
+	unique_ptr<uint8[]> Y;
+	unique_ptr<int16[]> U, V;
+	unique_ptr<uint8[]> Y_up, Y_left, Y_upleft;
+	unique_ptr<int16[]> U_up, U_left, U_upleft;
+	unique_ptr<int16[]> V_up, V_left, V_upleft;
+};
+
+inline static ReferenceFrame CloneReference(const ReferenceFrame& other, size_t size_Y, size_t size_UV) {
+	ReferenceFrame ref;
+
+	ref.Y = CloneArray(other.Y, size_Y);
+	ref.U = CloneArray(other.U, size_UV);
+	ref.V = CloneArray(other.V, size_UV);
+	ref.Y_up = CloneArray(other.Y_up, size_Y);
+	ref.Y_left = CloneArray(other.Y_left, size_Y);
+	ref.Y_upleft = CloneArray(other.Y_upleft, size_Y);
+	ref.U_up = CloneArray(other.U_up, size_UV);
+	ref.U_left = CloneArray(other.U_left, size_UV);
+	ref.U_upleft = CloneArray(other.U_upleft, size_UV);
+	ref.V_up = CloneArray(other.V_up, size_UV);
+	ref.V_left = CloneArray(other.V_left, size_UV);
+	ref.V_upleft = CloneArray(other.V_upleft, size_UV);
+
+	return ref;
+}
+
+inline static void SwapShiftedPlanes(ReferenceFrame& a, ReferenceFrame& b) {
+	std::swap(a.Y_up, b.Y_up);
+	std::swap(a.Y_left, b.Y_left);
+	std::swap(a.Y_upleft, b.Y_upleft);
+	std::swap(a.U_up, b.U_up);
+	std::swap(a.U_left, b.U_left);
+	std::swap(a.U_upleft, b.U_upleft);
+	std::swap(a.V_up, b.V_up);
+	std::swap(a.V_left, b.V_left);
+	std::swap(a.V_upleft, b.V_upleft);
+}
+
 class FilterTemplateDialog : public VDXVideoFilterDialog {
 public:
 	FilterTemplateDialog(FilterTemplateConfig& config, IVDXFilterPreview* preview)
@@ -268,28 +337,38 @@ protected:
 	void ProcessRGB32(void* dst, ptrdiff_t dst_pitch, const void* src, ptrdiff_t src_pitch);
 	void CopyFromSrc(const uint8* src, ptrdiff_t src_pitch);
 	void FillBorders();
+	ReferenceFrame MakeReference();
+	void ShiftHalfPixel(ReferenceFrame& ref);
+	void PushLookahead();
+	void PushReference();
 	void EstimateMotion();
 	void DrawOutput(uint8* dst, ptrdiff_t dst_pitch);
 	void CompensateMotion();
+	void ClampSample(const HalfGridSample& sample, sint32 x, sint32 y, sint32& sh_x, sint32& sh_y);
+	int SampleLuma(const ReferenceFrame& ref, const MV& mv, sint32 x, sint32 y);
+	void SampleChroma(const ReferenceFrame& ref, const MV& mv, sint32 x, sint32 y, int& U, int& V);
+	void PredictLuma(Prediction direction, sint32 block_id, sint32 x_begin, sint32 y_begin, sint32 x_end, sint32 y_end, uint8* block);
+	void PredictChroma(Prediction prediction, sint32 block_id, sint32 x, sint32 y, int& U, int& V);
 	void CopyToDst(uint8* dst, ptrdiff_t dst_pitch, const uint8* p_Y, ptrdiff_t Y_gap, const int16* p_U, const int16* p_V);
+	void DrawVector(uint8* dst, ptrdiff_t dst_pitch, const MotionField& field, sint32 node, sint32 x, sint32 y, sint32 size);
 	void DrawLine(uint8* dst, ptrdiff_t dst_pitch, sint32 x1, sint32 y1, sint32 x2, sint32 y2);
 	void MeasurePSNR();
 
 	sint32 width, height;
+	sint32 border;
 	sint32 width_ext, height_ext;
 	sint32 num_blocks_hor, num_blocks_vert;
 	unique_ptr<uint8[]> cur_Y;
 	unique_ptr<int16[]> cur_U, cur_V;
-	unique_ptr<uint8[]> prev_Y;
-	unique_ptr<int16[]> prev_U, prev_V;
-	unique_ptr<uint8[]> prev_Y_up, prev_Y_left, prev_Y_upleft;
-	unique_ptr<int16[]> prev_U_up, prev_U_left, prev_U_upleft;
-	unique_ptr<int16[]> prev_V_up, prev_V_left, prev_V_upleft;
+	vector<ReferenceFrame> refs;
+	ReferenceFrame lookahead;
+	ReferenceFrame cur_shifted;
 	unique_ptr<uint8[]> cur_Y_MC;
 	unique_ptr<int16[]> cur_U_MC, cur_V_MC;
 
 	unique_ptr<MotionEstimator> me;
-	unique_ptr<MV[]> vectors;
+	MotionField vectors;
+	MotionField forward_vectors;
 
 	bool measured_psnr;
 
@@ -297,12 +376,22 @@ protected:
 
 	ofstream perf_file, psnr_file;
 	double /*total_rgbtoyuv, total_borders, */total_me/*, total_output, total_copy*/;
+	double total_static;
+	double total_global;
+	double total_hash;
+	double total_range;
 	double total_y_psnr, total_u_psnr, total_v_psnr;
 	unsigned frame_count;
+	sint32 last_source_frame;
 };
 
 VDXVF_BEGIN_SCRIPT_METHODS(FilterTemplate)
 VDXVF_DEFINE_SCRIPT_METHOD(FilterTemplate, ScriptConfig, "iiiiii")
+VDXVF_DEFINE_SCRIPT_METHOD2(FilterTemplate, ScriptConfig, "iiiiiii")
+VDXVF_DEFINE_SCRIPT_METHOD2(FilterTemplate, ScriptConfig, "iiiiiiii")
+VDXVF_DEFINE_SCRIPT_METHOD2(FilterTemplate, ScriptConfig, "iiiiiiiii")
+VDXVF_DEFINE_SCRIPT_METHOD2(FilterTemplate, ScriptConfig, "iiiiiiiiii")
+VDXVF_DEFINE_SCRIPT_METHOD2(FilterTemplate, ScriptConfig, "iiiiiiiiiii")
 VDXVF_END_SCRIPT_METHODS()
 
 FilterTemplate::FilterTemplate() : VDXVideoFilter() {
@@ -312,45 +401,23 @@ FilterTemplate::FilterTemplate(const FilterTemplate& other)
 	: VDXVideoFilter(other)
 	, width(other.width)
 	, height(other.height)
-	, num_blocks_hor(other.num_blocks_hor)
-	, num_blocks_vert(other.num_blocks_vert)
+	, border(other.border)
 	, width_ext(other.width_ext)
 	, height_ext(other.height_ext)
+	, num_blocks_hor(other.num_blocks_hor)
+	, num_blocks_vert(other.num_blocks_vert)
 	, cur_Y(new uint8[width_ext * height_ext])
 	, cur_U(new int16[width * height])
 	, cur_V(new int16[width * height])
 	, config(other.config) {
-	if (other.prev_Y) {
-		prev_Y = make_unique<uint8[]>(width_ext * height_ext);
-		prev_U = make_unique<int16[]>(width * height);
-		prev_V = make_unique<int16[]>(width * height);
-
-		memcpy(prev_Y.get(), other.prev_Y.get(), width_ext * height_ext);
-		memcpy(prev_U.get(), other.prev_U.get(), width * height * 2);
-		memcpy(prev_V.get(), other.prev_V.get(), width * height * 2);
-	}
+	const auto size_Y = width_ext * height_ext;
+	const auto size_UV = width * height;
 
-	if (other.prev_Y_up) {
-		prev_Y_up = make_unique<uint8[]>(width_ext * height_ext);
-		prev_Y_left = make_unique<uint8[]>(width_ext * height_ext);
-		prev_Y_upleft = make_unique<uint8[]>(width_ext * height_ext);
-		prev_U_up = make_unique<int16[]>(width * height);
-		prev_U_left = make_unique<int16[]>(width * height);
-		prev_U_upleft = make_unique<int16[]>(width * height);
-		prev_V_up = make_unique<int16[]>(width * height);
-		prev_V_left = make_unique<int16[]>(width * height);
-		prev_V_upleft = make_unique<int16[]>(width * height);
-
-		memcpy(prev_Y_up.get(), other.prev_Y_up.get(), width_ext * height_ext);
-		memcpy(prev_Y_left.get(), other.prev_Y_left.get(), width_ext * height_ext);
-		memcpy(prev_Y_upleft.get(), other.prev_Y_upleft.get(), width_ext * height_ext);
-		memcpy(prev_U_up.get(), other.prev_U_up.get(), width * height * 2);
-		memcpy(prev_U_left.get(), other.prev_U_left.get(), width * height * 2);
-		memcpy(prev_U_upleft.get(), other.prev_U_upleft.get(), width * height * 2);
-		memcpy(prev_V_up.get(), other.prev_V_up.get(), width * height * 2);
-		memcpy(prev_V_left.get(), other.prev_V_left.get(), width * height * 2);
-		memcpy(prev_V_upleft.get(), other.prev_V_upleft.get(), width * height * 2);
-	}
+	for (const auto& ref : other.refs)
+		refs.push_back(CloneReference(ref, size_Y, size_UV));
+
+	lookahead = CloneReference(other.lookahead, size_Y, size_UV);
+	cur_shifted = CloneReference(other.cur_shifted, size_Y, size_UV);
 }
 
 uint32 FilterTemplate::GetParams() {
@@ -365,7 +432,7 @@ uint32 FilterTemplate::GetParams() {
 	}
 
 	fa->dst.offset = 0;
-	return FILTERPARAM_SWAP_BUFFERS | FILTERPARAM_NEEDS_LAST;
+	return FILTERPARAM_SWAP_BUFFERS | FILTERPARAM_NEEDS_LAST | FILTERPARAM_HAS_LAG(config.bidirectional ? 1 : 0);
 }
 
 void FilterTemplate::Start() {
@@ -379,8 +446,18 @@ void FilterTemplate::Start() {
 		height = fa->src.h;
 	}
 
-	width_ext = width + 2 * MotionEstimator::BORDER;
-	height_ext = height + 2 * MotionEstimator::BORDER;
+	// The estimator decides how wide the borders must be for its search range.
+	me = make_unique<MotionEstimator>(width,
+	                                  height,
+	                                  config.quality,
+	                                  config.use_half_pixel,
+	                                  config.num_threads,
+	                                  config.hash_matching,
+	                                  config.search_range);
+
+	border = me->GetBorder();
+	width_ext = width + 2 * border;
+	height_ext = height + 2 * border;
 
 	num_blocks_hor = (width + MotionEstimator::BLOCK_SIZE - 1) / MotionEstimator::BLOCK_SIZE;
 	num_blocks_vert = (height + MotionEstimator::BLOCK_SIZE - 1) / MotionEstimator::BLOCK_SIZE;
@@ -388,24 +465,19 @@ void FilterTemplate::Start() {
 	cur_Y = make_unique<uint8[]>(width_ext * height_ext);
 	cur_U = make_unique<int16[]>(width * height);
 	cur_V = make_unique<int16[]>(width * height);
-	prev_Y.reset();
-	prev_U.reset();
-	prev_V.reset();
-	prev_Y_up.reset();
-	prev_Y_left.reset();
-	prev_Y_upleft.reset();
-	prev_U_up.reset();
-	prev_U_left.reset();
-	prev_U_upleft.reset();
-	prev_V_up.reset();
-	prev_V_left.reset();
-	prev_V_upleft.reset();
+	refs.clear();
+	lookahead = ReferenceFrame();
+	cur_shifted = ReferenceFrame();
 	cur_Y_MC.reset();
 	cur_U_MC.reset();
 	cur_V_MC.reset();
 
-	me = make_unique<MotionEstimator>(width, height, config.quality, config.use_half_pixel);
-	vectors = make_unique<MV[]>(num_blocks_hor * num_blocks_vert);
+	vectors = MotionField(num_blocks_hor * num_blocks_vert);
+
+	if (config.bidirectional)
+		forward_vectors = MotionField(num_blocks_hor * num_blocks_vert);
+	else
+		forward_vectors = MotionField();
 
 	perf_file.open("ME_performance.log", std::ios::app);
 
@@ -421,12 +493,17 @@ void FilterTemplate::Start() {
 	//total_output = 0.0;
 	total_me = 0.0;
 	//total_copy = 0.0;
+	total_static = 0.0;
+	total_global = 0.0;
+	total_hash = 0.0;
+	total_range = 0.0;
 	
 	total_y_psnr = 0.0;
 	total_u_psnr = 0.0;
 	total_v_psnr = 0.0;
 
 	frame_count = 0;
+	last_source_frame = -1;
 }
 
 void FilterTemplate::Run() {
@@ -455,6 +532,10 @@ void FilterTemplate::End() {
 		//perf_file << "Output: " << total_output / frame_count << '\n';
 		//perf_file << "Copy: " << total_copy / frame_count << '\n';
 		perf_file << "Average ME time (ms per frame): " << total_me / frame_count << '\n';
+		perf_file << "Average static blocks (% per frame): " << 100 * total_static / frame_count << '\n';
+		perf_file << "Average global motion blocks (% per frame): " << 100 * total_global / frame_count << '\n';
+		perf_file << "Average hash matched blocks (% per frame): " << 100 * total_hash / frame_count << '\n';
+		perf_file << "Average search range (pixels per searched block): " << total_range / frame_count << '\n';
 
 		if (config.measure_psnr) {
 			perf_file << "Average Y PSNR: " << total_y_psnr / (frame_count - 1) << '\n';
@@ -484,13 +565,18 @@ bool FilterTemplate::Configure(VDXHWND hwnd) {
 void FilterTemplate::GetScriptString(char* buf, int maxlen) {
 	SafePrintf(buf,
 	           maxlen,
-	           "Config(%d, %d, %d, %d, %d, %d)",
+	           "Config(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d)",
 	           static_cast<int>(config.output_type),
 	           config.show_vectors ? 1 : 0,
 	           config.draw_nothing ? 1 : 0,
 	           config.measure_psnr ? 1 : 0,
 	           config.quality,
-	           config.use_half_pixel ? 1 : 0);
+	           config.use_half_pixel ? 1 : 0,
+	           config.num_threads,
+	           config.num_references,
+	           config.bidirectional ? 1 : 0,
+	           config.hash_matching ? 1 : 0,
+	           config.search_range);
 }
 
 void FilterTemplate::ScriptConfig(IVDXScriptInterpreter *isi, const VDXScriptValue *argv, int argc) {
@@ -500,6 +586,13 @@ void FilterTemplate::ScriptConfig(IVDXScriptInterpreter *isi, const VDXScriptVal
 	config.measure_psnr = !!argv[3].asInt();
 	config.quality = clamp(argv[4].asInt(), 0, 100);
 	config.use_half_pixel = !!argv[5].asInt();
+
+	// Scripts written before the thread count was added have six arguments.
+	config.num_threads = (argc > 6) ? clamp(argv[6].asInt(), 0, 256) : 0;
+	config.num_references = (argc > 7) ? clamp(argv[7].asInt(), 1, MotionEstimator::MAX_REFERENCES) : 1;
+	config.bidirectional = (argc > 8) && !!argv[8].asInt();
+	config.hash_matching = (argc > 9) && !!argv[9].asInt();
+	config.search_range = (argc > 10) ? clamp(argv[10].asInt(), 1, MotionEstimator::MAX_SEARCH_RANGE) : MotionEstimator::DEFAULT_SEARCH_RANGE;
 }
 
 void FilterTemplate::ProcessRGB32(void* dst0, ptrdiff_t dst_pitch, const void* src0, ptrdiff_t src_pitch) {
@@ -518,57 +611,50 @@ void FilterTemplate::ProcessRGB32(void* dst0, ptrdiff_t dst_pitch, const void* s
 	//end = chrono::steady_clock::now();
 	//total_borders += chrono::duration<double, std::milli>(end - start).count();
 
-	// On the first frame, copy cur_{Y,U,V} to prev_{Y,U,V}.
-	if (!prev_Y || !prev_U || !prev_V) {
-		prev_Y = make_unique<uint8[]>(width_ext * height_ext);
-		prev_U = make_unique<int16[]>(width * height);
-		prev_V = make_unique<int16[]>(width * height);
-
-		memcpy(prev_Y.get(), cur_Y.get(), width_ext * height_ext);
-		memcpy(prev_U.get(), cur_U.get(), width * height * 2);
-		memcpy(prev_V.get(), cur_V.get(), width * height * 2);
+	// After a seek the references and the lookahead hold frames from elsewhere
+	// in the video, so they start over as on the first frame.
+	const auto source_frame = fa->pfsi ? fa->pfsi->lCurrentSourceFrame : last_source_frame + 1;
+	if (source_frame != last_source_frame + 1) {
+		refs.clear();
+		lookahead = ReferenceFrame();
+		cur_shifted = ReferenceFrame();
 	}
 
-	// Half-pixel shifts.
-	if (config.use_half_pixel) {
-		if (!prev_Y_up) {
-			prev_Y_up = make_unique<uint8[]>(width_ext * height_ext);
-			prev_Y_left = make_unique<uint8[]>(width_ext * height_ext);
-			prev_Y_upleft = make_unique<uint8[]>(width_ext * height_ext);
-			prev_U_up = make_unique<int16[]>(width * height);
-			prev_U_left = make_unique<int16[]>(width * height);
-			prev_U_upleft = make_unique<int16[]>(width * height);
-			prev_V_up = make_unique<int16[]>(width * height);
-			prev_V_left = make_unique<int16[]>(width * height);
-			prev_V_upleft = make_unique<int16[]>(width * height);
+	last_source_frame = source_frame;
+
+	// In the bidirectional mode the output lags one frame behind the input:
+	// the frame that came in is the lookahead, and the previous lookahead
+	// is the current frame.
+	if (config.bidirectional) {
+		if (!lookahead.Y) {
+			// There is no current frame yet, and VirtualDub drops this output.
+			lookahead = MakeReference();
+			PushLookahead();
+
+			CopyToDst(dst,
+			          dst_pitch,
+			          lookahead.Y.get() + width_ext * border + border,
+			          2 * border,
+			          lookahead.U.get(),
+			          lookahead.V.get());
+			return;
 		}
 
-		memcpy(prev_Y_up.get(), prev_Y.get(), width_ext * height_ext);
-		memcpy(prev_Y_left.get(), prev_Y.get(), width_ext * height_ext);
-		memcpy(prev_Y_upleft.get(), prev_Y.get(), width_ext * height_ext);
-
-		HalfpixelShiftHorz(prev_Y_left.get(), width_ext, height_ext, false);
-		HalfpixelShift(prev_Y_up.get(), width_ext, height_ext, false);
-		HalfpixelShift(prev_Y_upleft.get(), width_ext, height_ext, false);
-		HalfpixelShiftHorz(prev_Y_upleft.get(), width_ext, height_ext, false);
-
-		memcpy(prev_U_up.get(), prev_U.get(), width * height * 2);
-		memcpy(prev_U_left.get(), prev_U.get(), width * height * 2);
-		memcpy(prev_U_upleft.get(), prev_U.get(), width * height * 2);
+		PushLookahead();
+	}
 
-		HalfpixelShiftHorz(prev_U_left.get(), width, height, false);
-		HalfpixelShift(prev_U_up.get(), width, height, false);
-		HalfpixelShift(prev_U_upleft.get(), width, height, false);
-		HalfpixelShiftHorz(prev_U_upleft.get(), width, height, false);
+	// On the first frame, the current frame is its own reference, and the
+	// estimator forgets the frames before.
+	if (refs.empty()) {
+		me->Reset();
+		refs.push_back(MakeReference());
 
-		memcpy(prev_V_up.get(), prev_V.get(), width * height * 2);
-		memcpy(prev_V_left.get(), prev_V.get(), width * height * 2);
-		memcpy(prev_V_upleft.get(), prev_V.get(), width * height * 2);
+		memcpy(refs[0].Y.get(), cur_Y.get(), width_ext * height_ext);
+		memcpy(refs[0].U.get(), cur_U.get(), width * height * 2);
+		memcpy(refs[0].V.get(), cur_V.get(), width * height * 2);
 
-		HalfpixelShiftHorz(prev_V_left.get(), width, height, false);
-		HalfpixelShift(prev_V_up.get(), width, height, false);
-		HalfpixelShift(prev_V_upleft.get(), width, height, false);
-		HalfpixelShiftHorz(prev_V_upleft.get(), width, height, false);
+		if (config.use_half_pixel)
+			ShiftHalfPixel(refs[0]);
 	}
 
 	// Call the motion estimator.
@@ -596,11 +682,9 @@ void FilterTemplate::ProcessRGB32(void* dst0, ptrdiff_t dst_pitch, const void* s
 		MeasurePSNR();
 	}
 
-	// Copy cur_{Y,U,V} to prev_{Y,U,V}.
+	// Make cur_{Y,U,V} the newest reference.
 	//start = chrono::steady_clock::now();
-	memcpy(prev_Y.get(), cur_Y.get(), width_ext * height_ext);
-	memcpy(prev_U.get(), cur_U.get(), width * height * 2);
-	memcpy(prev_V.get(), cur_V.get(), width * height * 2);
+	PushReference();
 	//end = chrono::steady_clock::now();
 	//total_copy += chrono::duration<double, std::milli>(end - start).count();
 
@@ -608,7 +692,7 @@ void FilterTemplate::ProcessRGB32(void* dst0, ptrdiff_t dst_pitch, const void* s
 }
 
 void FilterTemplate::CopyFromSrc(const uint8* src, ptrdiff_t src_pitch) {
-	auto p_cur_Y = cur_Y.get() + width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER;
+	auto p_cur_Y = cur_Y.get() + width_ext * border + border;
 	auto p_cur_U = cur_U.get();
 	auto p_cur_V = cur_V.get();
 
@@ -628,27 +712,27 @@ void FilterTemplate::CopyFromSrc(const uint8* src, ptrdiff_t src_pitch) {
 			p_src += 4;
 		}
 
-		p_cur_Y += 2 * MotionEstimator::BORDER;
+		p_cur_Y += 2 * border;
 		src += src_pitch;
 	}
 }
 
 void FilterTemplate::FillBorders() {
 	// Left and right borders.
-	auto p_cur_Y = cur_Y.get() + width_ext * MotionEstimator::BORDER;
+	auto p_cur_Y = cur_Y.get() + width_ext * border;
 
 	for (sint32 y = 0; y < height; ++y) {
-		memset(p_cur_Y, p_cur_Y[MotionEstimator::BORDER], MotionEstimator::BORDER);
-		p_cur_Y += MotionEstimator::BORDER + width;
-		memset(p_cur_Y, p_cur_Y[-1], MotionEstimator::BORDER);
-		p_cur_Y += MotionEstimator::BORDER;
+		memset(p_cur_Y, p_cur_Y[border], border);
+		p_cur_Y += border + width;
+		memset(p_cur_Y, p_cur_Y[-1], border);
+		p_cur_Y += border;
 	}
 
 	// Top and bottom borders.
 	p_cur_Y = cur_Y.get();
-	auto p_cur_Y_row = p_cur_Y + width_ext * MotionEstimator::BORDER;
+	auto p_cur_Y_row = p_cur_Y + width_ext * border;
 
-	for (sint32 y = 0; y < MotionEstimator::BORDER; ++y) {
+	for (sint32 y = 0; y < border; ++y) {
 		memcpy(p_cur_Y, p_cur_Y_row, width_ext);
 		p_cur_Y += width_ext;
 	}
@@ -656,24 +740,122 @@ void FilterTemplate::FillBorders() {
 	p_cur_Y += width_ext * height;
 	p_cur_Y_row = p_cur_Y - width_ext;
 
-	for (sint32 y = 0; y < MotionEstimator::BORDER; ++y) {
+	for (sint32 y = 0; y < border; ++y) {
 		memcpy(p_cur_Y, p_cur_Y_row, width_ext);
 		p_cur_Y += width_ext;
 	}
 }
 
+ReferenceFrame FilterTemplate::MakeReference() {
+	ReferenceFrame ref;
+
+	ref.Y = make_unique<uint8[]>(width_ext * height_ext);
+	ref.U = make_unique<int16[]>(width * height);
+	ref.V = make_unique<int16[]>(width * height);
+
+	return ref;
+}
+
+void FilterTemplate::ShiftHalfPixel(ReferenceFrame& ref) {
+	if (!ref.Y_up) {
+		ref.Y_up = make_unique<uint8[]>(width_ext * height_ext);
+		ref.Y_left = make_unique<uint8[]>(width_ext * height_ext);
+		ref.Y_upleft = make_unique<uint8[]>(width_ext * height_ext);
+		ref.U_up = make_unique<int16[]>(width * height);
+		ref.U_left = make_unique<int16[]>(width * height);
+		ref.U_upleft = make_unique<int16[]>(width * height);
+		ref.V_up = make_unique<int16[]>(width * height);
+		ref.V_left = make_unique<int16[]>(width * height);
+		ref.V_upleft = make_unique<int16[]>(width * height);
+	}
+
+	memcpy(ref.Y_up.get(), ref.Y.get(), width_ext * height_ext);
+	memcpy(ref.Y_left.get(), ref.Y.get(), width_ext * height_ext);
+	memcpy(ref.Y_upleft.get(), ref.Y.get(), width_ext * height_ext);
+
+	HalfpixelShiftHorz(ref.Y_left.get(), width_ext, height_ext, false);
+	HalfpixelShift(ref.Y_up.get(), width_ext, height_ext, false);
+	HalfpixelShift(ref.Y_upleft.get(), width_ext, height_ext, false);
+	HalfpixelShiftHorz(ref.Y_upleft.get(), width_ext, height_ext, false);
+
+	memcpy(ref.U_up.get(), ref.U.get(), width * height * 2);
+	memcpy(ref.U_left.get(), ref.U.get(), width * height * 2);
+	memcpy(ref.U_upleft.get(), ref.U.get(), width * height * 2);
+
+	HalfpixelShiftHorz(ref.U_left.get(), width, height, false);
+	HalfpixelShift(ref.U_up.get(), width, height, false);
+	HalfpixelShift(ref.U_upleft.get(), width, height, false);
+	HalfpixelShiftHorz(ref.U_upleft.get(), width, height, false);
+
+	memcpy(ref.V_up.get(), ref.V.get(), width * height * 2);
+	memcpy(ref.V_left.get(), ref.V.get(), width * height * 2);
+	memcpy(ref.V_upleft.get(), ref.V.get(), width * height * 2);
+
+	HalfpixelShiftHorz(ref.V_left.get(), width, height, false);
+	HalfpixelShift(ref.V_up.get(), width, height, false);
+	HalfpixelShift(ref.V_upleft.get(), width, height, false);
+	HalfpixelShiftHorz(ref.V_upleft.get(), width, height, false);
+}
+
+void FilterTemplate::PushLookahead() {
+	// The new frame and the lookahead trade buffers, and the current frame
+	// takes over the shifted planes made while it was the lookahead.
+	std::swap(lookahead.Y, cur_Y);
+	std::swap(lookahead.U, cur_U);
+	std::swap(lookahead.V, cur_V);
+	SwapShiftedPlanes(lookahead, cur_shifted);
+
+	if (config.use_half_pixel)
+		ShiftHalfPixel(lookahead);
+}
+
+void FilterTemplate::PushReference() {
+	// The ring grows up to num_references frames. The copy made on the first
+	// frame is replaced rather than kept next to the frame it copies.
+	if (frame_count > 0 && refs.size() < static_cast<size_t>(config.num_references))
+		refs.push_back(MakeReference());
+
+	// The oldest reference takes the current frame and hands its buffers over
+	// to the next one, so the frames are never copied.
+	auto& ref = refs.back();
+	std::swap(ref.Y, cur_Y);
+	std::swap(ref.U, cur_U);
+	std::swap(ref.V, cur_V);
+
+	// The shifted planes are made once, when the frame becomes a reference,
+	// or earlier in the bidirectional mode, when it becomes the lookahead.
+	if (config.bidirectional)
+		SwapShiftedPlanes(ref, cur_shifted);
+	else if (config.use_half_pixel)
+		ShiftHalfPixel(ref);
+
+	std::rotate(refs.begin(), refs.end() - 1, refs.end());
+}
+
 void FilterTemplate::EstimateMotion() {
 	const auto start = chrono::steady_clock::now();
 
-	me->Estimate(cur_Y.get(),
-	             prev_Y.get(),
-	             prev_Y_up.get(),
-	             prev_Y_left.get(),
-	             prev_Y_upleft.get(),
-	             vectors.get());
+	MotionEstimator::ReferencePlanes planes[MotionEstimator::MAX_REFERENCES];
+
+	for (size_t i = 0; i < refs.size(); ++i)
+		planes[i] = { { refs[i].Y.get(), refs[i].Y_up.get(), refs[i].Y_left.get(), refs[i].Y_upleft.get() } };
+
+	me->Estimate(cur_Y.get(), planes, static_cast<int>(refs.size()), vectors);
+
+	if (config.bidirectional) {
+		const MotionEstimator::ReferencePlanes next = {
+			{ lookahead.Y.get(), lookahead.Y_up.get(), lookahead.Y_left.get(), lookahead.Y_upleft.get() }
+		};
+
+		me->EstimateForward(cur_Y.get(), next, vectors, forward_vectors);
+	}
 
 	const auto end = chrono::steady_clock::now();
 	total_me += chrono::duration<double, std::milli>(end - start).count();
+	total_static += me->GetStaticRatio();
+	total_global += me->GetGlobalRatio();
+	total_hash += me->GetHashRatio();
+	total_range += me->GetAverageRange();
 }
 
 void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
@@ -683,10 +865,10 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 	ptrdiff_t Y_gap;
 
 	if (config.output_type == OutputType::SOURCE) {
-		p_Y = cur_Y.get() + width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER;
+		p_Y = cur_Y.get() + width_ext * border + border;
 		p_U = cur_U.get();
 		p_V = cur_V.get();
-		Y_gap = 2 * MotionEstimator::BORDER;
+		Y_gap = 2 * border;
 	} else {
 		if (!cur_Y_MC || !cur_U_MC || !cur_V_MC) {
 			cur_Y_MC = make_unique<uint8[]>(width * height);
@@ -704,7 +886,7 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 
 		if (config.output_type == OutputType::RESIDUAL_BEFORE_MC) {
 			// We don't use the compensated frame here, simply copy the previous one.
-			auto prev = prev_Y.get() + width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER;;
+			auto prev = refs[0].Y.get() + width_ext * border + border;
 			auto p_Y_MC = cur_Y_MC.get();
 
 			for (sint32 y = 0; y < height; ++y) {
@@ -713,8 +895,8 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 				p_Y_MC += width;
 			}
 
-			memcpy(cur_U_MC.get(), prev_U.get(), width * height * 2);
-			memcpy(cur_V_MC.get(), prev_V.get(), width * height * 2);
+			memcpy(cur_U_MC.get(), refs[0].U.get(), width * height * 2);
+			memcpy(cur_V_MC.get(), refs[0].V.get(), width * height * 2);
 		}
 
 		// For residuals, subtract the current frame.
@@ -724,7 +906,7 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 			auto p_U_MC = cur_U_MC.get();
 			auto p_V_MC = cur_V_MC.get();
 
-			auto p_Y_cur = cur_Y.get() + width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER;
+			auto p_Y_cur = cur_Y.get() + width_ext * border + border;
 			auto p_U_cur = cur_U.get();
 			auto p_V_cur = cur_V.get();
 
@@ -742,7 +924,7 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 					++p_V_cur;
 				}
 
-				p_Y_cur += 2 * MotionEstimator::BORDER;
+				p_Y_cur += 2 * border;
 			}
 		}
 
@@ -757,111 +939,258 @@ void FilterTemplate::DrawOutput(uint8* dst, ptrdiff_t dst_pitch) {
 	if (config.show_vectors) {
 		for (sint32 i = 0; i < num_blocks_vert; ++i) {
 			for (sint32 j = 0; j < num_blocks_hor; ++j) {
-				auto mv = vectors[i * num_blocks_hor + j];
-
-				if (!mv.IsSplit()) {
-					DrawLine(dst,
-					         dst_pitch,
-					         j * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2,
-					         i * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2,
-					         j * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2 + mv.x,
-					         i * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2 + mv.y);
-				} else {
-					for (int h = 0; h < 4; ++h) {
-						const auto mv_ = mv.SubVector(h);
-						const auto x = j * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2
-							+ (h & 1 ? 1 : -1) * (MotionEstimator::BLOCK_SIZE / 4);
-						const auto y = i * MotionEstimator::BLOCK_SIZE + MotionEstimator::BLOCK_SIZE / 2
-							+ (h > 1 ? 1 : -1) * (MotionEstimator::BLOCK_SIZE / 4);
-
-						DrawLine(dst,
-						         dst_pitch,
-						         x,
-						         y,
-						         x + mv_.x,
-						         y + mv_.y);
-					}
-				}
+				DrawVector(dst,
+				           dst_pitch,
+				           vectors,
+				           i * num_blocks_hor + j,
+				           j * MotionEstimator::BLOCK_SIZE,
+				           i * MotionEstimator::BLOCK_SIZE,
+				           MotionEstimator::BLOCK_SIZE);
 			}
 		}
 	}
 }
 
-void FilterTemplate::CompensateMotion() {
-	auto p_Y_MC = cur_Y_MC.get();
-	auto p_U_MC = cur_U_MC.get();
-	auto p_V_MC = cur_V_MC.get();
+void FilterTemplate::DrawVector(uint8* dst, ptrdiff_t dst_pitch, const MotionField& field, sint32 node, sint32 x, sint32 y, sint32 size) {
+	if (field.IsSplit(node)) {
+		for (int h = 0; h < 4; ++h) {
+			DrawVector(dst,
+			           dst_pitch,
+			           field,
+			           field.Child(node, h),
+			           x + ((h & 1) ? size / 2 : 0),
+			           y + ((h > 1) ? size / 2 : 0),
+			           size / 2);
+		}
 
-	for (sint32 y = 0; y < height; ++y) {
-		for (sint32 x = 0; x < width; ++x) {
-			const auto i = (y / MotionEstimator::BLOCK_SIZE);
-			const auto j = (x / MotionEstimator::BLOCK_SIZE);
-			auto mv = vectors[i * num_blocks_hor + j];
-
-			if (mv.IsSplit()) {
-				const auto h = (((y % MotionEstimator::BLOCK_SIZE) < (MotionEstimator::BLOCK_SIZE / 2)) ? 0 : 2)
-					+ (((x % MotionEstimator::BLOCK_SIZE) < (MotionEstimator::BLOCK_SIZE / 2)) ? 0 : 1);
-				mv = mv.SubVector(h);
+		return;
+	}
+
+	const auto mv = field.Get(node);
+	DrawLine(dst,
+	         dst_pitch,
+	         x + size / 2,
+	         y + size / 2,
+	         x + size / 2 + ((mv.x + MV::ONE / 2) >> MV::FRACTION_BITS),
+	         y + size / 2 + ((mv.y + MV::ONE / 2) >> MV::FRACTION_BITS));
+}
+
+void FilterTemplate::ClampSample(const HalfGridSample& sample, sint32 x, sint32 y, sint32& sh_x, sint32& sh_y) {
+	if (x + sample.x < 0)
+		sh_x = -x;
+	else if (x + sample.x >= width)
+		sh_x = width - 1 - x;
+	else
+		sh_x = sample.x;
+
+	if (y + sample.y < 0)
+		sh_y = -y;
+	else if (y + sample.y >= height)
+		sh_y = height - 1 - y;
+	else
+		sh_y = sample.y;
+}
+
+int FilterTemplate::SampleLuma(const ReferenceFrame& ref, const MV& mv, sint32 x, sint32 y) {
+	// Quarter-pixel samples average two samples of the half-pixel grid.
+	HalfGridSample samples[2];
+	GetSubpelSources(mv.x, mv.y, samples[0], samples[1]);
+
+	int Y = 0;
+
+	for (const auto& sample : samples) {
+		const uint8* p_Y;
+
+		switch (sample.plane) {
+		default:
+		case ShiftDir::NONE:
+			p_Y = ref.Y.get();
+			break;
+
+		case ShiftDir::UP:
+			p_Y = ref.Y_up.get();
+			break;
+
+		case ShiftDir::LEFT:
+			p_Y = ref.Y_left.get();
+			break;
+
+		case ShiftDir::UPLEFT:
+			p_Y = ref.Y_upleft.get();
+			break;
+		}
+
+		p_Y += width_ext * border + border
+			+ y * width_ext + x;
+
+		sint32 sh_x, sh_y;
+		ClampSample(sample, x, y, sh_x, sh_y);
+
+		Y += p_Y[sh_y * width_ext + sh_x];
+	}
+
+	return (Y + 1) >> 1;
+}
+
+void FilterTemplate::SampleChroma(const ReferenceFrame& ref, const MV& mv, sint32 x, sint32 y, int& U, int& V) {
+	HalfGridSample samples[2];
+	GetSubpelSources(mv.x, mv.y, samples[0], samples[1]);
+
+	U = 0;
+	V = 0;
+
+	for (const auto& sample : samples) {
+		const int16* p_U;
+		const int16* p_V;
+
+		switch (sample.plane) {
+		default:
+		case ShiftDir::NONE:
+			p_U = ref.U.get();
+			p_V = ref.V.get();
+			break;
+
+		case ShiftDir::UP:
+			p_U = ref.U_up.get();
+			p_V = ref.V_up.get();
+			break;
+
+		case ShiftDir::LEFT:
+			p_U = ref.U_left.get();
+			p_V = ref.V_left.get();
+			break;
+
+		case ShiftDir::UPLEFT:
+			p_U = ref.U_upleft.get();
+			p_V = ref.V_upleft.get();
+			break;
+		}
+
+		p_U += y * width + x;
+		p_V += y * width + x;
+
+		sint32 sh_x, sh_y;
+		ClampSample(sample, x, y, sh_x, sh_y);
+
+		U += p_U[sh_y * width + sh_x];
+		V += p_V[sh_y * width + sh_x];
+	}
+
+	U = (U + 1) >> 1;
+	V = (V + 1) >> 1;
+}
+
+void FilterTemplate::PredictLuma(Prediction direction, sint32 block_id, sint32 x_begin, sint32 y_begin, sint32 x_end, sint32 y_end, uint8* block) {
+	for (sint32 y = y_begin; y < y_end; ++y) {
+		for (sint32 x = x_begin; x < x_end; ++x) {
+			int Y;
+			if (direction == Prediction::FORWARD) {
+				Y = SampleLuma(lookahead, forward_vectors.Get(forward_vectors.GetLeaf(block_id, x, y)), x, y);
+			} else {
+				const auto mv = vectors.Get(vectors.GetLeaf(block_id, x, y));
+				Y = SampleLuma(refs[mv.ref], mv, x, y);
 			}
 
-			uint8* p_Y;
-			int16* p_U;
-			int16* p_V;
-
-			switch (mv.shift_dir) {
-			default:
-			case ShiftDir::NONE:
-				p_Y = prev_Y.get();
-				p_U = prev_U.get();
-				p_V = prev_V.get();
-				break;
-
-			case ShiftDir::UP:
-				p_Y = prev_Y_up.get();
-				p_U = prev_U_up.get();
-				p_V = prev_V_up.get();
-				break;
-
-			case ShiftDir::LEFT:
-				p_Y = prev_Y_left.get();
-				p_U = prev_U_left.get();
-				p_V = prev_V_left.get();
-				break;
-
-			case ShiftDir::UPLEFT:
-				p_Y = prev_Y_upleft.get();
-				p_U = prev_U_upleft.get();
-				p_V = prev_V_upleft.get();
-				break;
+			block[(y - y_begin) * MotionEstimator::BLOCK_SIZE + (x - x_begin)] = static_cast<uint8>(Y);
+		}
+	}
+}
+
+void FilterTemplate::PredictChroma(Prediction prediction, sint32 block_id, sint32 x, sint32 y, int& U, int& V) {
+	if (prediction != Prediction::FORWARD) {
+		const auto mv = vectors.Get(vectors.GetLeaf(block_id, x, y));
+		SampleChroma(refs[mv.ref], mv, x, y, U, V);
+	}
+
+	if (prediction != Prediction::BACKWARD) {
+		int U_fwd, V_fwd;
+		SampleChroma(lookahead, forward_vectors.Get(forward_vectors.GetLeaf(block_id, x, y)), x, y, U_fwd, V_fwd);
+
+		if (prediction == Prediction::FORWARD) {
+			U = U_fwd;
+			V = V_fwd;
+		} else {
+			U = (U + U_fwd + 1) >> 1;
+			V = (V + V_fwd + 1) >> 1;
+		}
+	}
+}
+
+void FilterTemplate::CompensateMotion() {
+	const auto p_Y_cur = cur_Y.get() + width_ext * border + border;
+
+	// Luma of a block predicted from each direction, row by row
+	uint8 Y_bwd[MotionEstimator::BLOCK_SIZE * MotionEstimator::BLOCK_SIZE];
+	uint8 Y_fwd[MotionEstimator::BLOCK_SIZE * MotionEstimator::BLOCK_SIZE];
+
+	for (sint32 i = 0; i < num_blocks_vert; ++i) {
+		for (sint32 j = 0; j < num_blocks_hor; ++j) {
+			const auto block_id = i * num_blocks_hor + j;
+			const auto x_begin = j * MotionEstimator::BLOCK_SIZE;
+			const auto y_begin = i * MotionEstimator::BLOCK_SIZE;
+			const auto x_end = min(x_begin + MotionEstimator::BLOCK_SIZE, width);
+			const auto y_end = min(y_begin + MotionEstimator::BLOCK_SIZE, height);
+
+			PredictLuma(Prediction::BACKWARD, block_id, x_begin, y_begin, x_end, y_end, Y_bwd);
+
+			// In the bidirectional mode a block takes whichever of the backward,
+			// forward and averaged predictions has the smallest luma SAD. The
+			// chroma is only interpolated for the prediction that is taken.
+			auto prediction = Prediction::BACKWARD;
+
+			if (config.bidirectional) {
+				PredictLuma(Prediction::FORWARD, block_id, x_begin, y_begin, x_end, y_end, Y_fwd);
+
+				long errors[3] = { 0, 0, 0 };
+
+				for (sint32 y = y_begin; y < y_end; ++y) {
+					const auto row = (y - y_begin) * MotionEstimator::BLOCK_SIZE - x_begin;
+
+					for (sint32 x = x_begin; x < x_end; ++x) {
+						const int cur = p_Y_cur[y * width_ext + x];
+						const int bwd = Y_bwd[row + x];
+						const int fwd = Y_fwd[row + x];
+
+						errors[static_cast<int>(Prediction::BACKWARD)] += abs(bwd - cur);
+						errors[static_cast<int>(Prediction::FORWARD)] += abs(fwd - cur);
+						errors[static_cast<int>(Prediction::AVERAGE)] += abs(((bwd + fwd + 1) >> 1) - cur);
+					}
+				}
+
+				for (int k = 1; k < 3; ++k) {
+					if (errors[k] < errors[static_cast<int>(prediction)])
+						prediction = static_cast<Prediction>(k);
+				}
 			}
 
-			p_Y += width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER
-				+ y * width_ext + x;
-			p_U += y * width + x;
-			p_V += y * width + x;
+			for (sint32 y = y_begin; y < y_end; ++y) {
+				const auto row = (y - y_begin) * MotionEstimator::BLOCK_SIZE - x_begin;
 
-			int sh_x, sh_y;
-			if (x + mv.x < 0)
-				sh_x = -x;
-			else if (x + mv.x >= width)
-				sh_x = width - 1 - x;
-			else
-				sh_x = mv.x;
+				for (sint32 x = x_begin; x < x_end; ++x) {
+					int Y;
+					switch (prediction) {
+					default:
+					case Prediction::BACKWARD:
+						Y = Y_bwd[row + x];
+						break;
 
-			if (y + mv.y < 0)
-				sh_y = -y;
-			else if (y + mv.y >= height)
-				sh_y = height - 1 - y;
-			else
-				sh_y = mv.y;
+					case Prediction::FORWARD:
+						Y = Y_fwd[row + x];
+						break;
 
-			*p_Y_MC = p_Y[sh_y * width_ext + sh_x];
-			*p_U_MC = p_U[sh_y * width + sh_x];
-			*p_V_MC = p_V[sh_y * width + sh_x];
+					case Prediction::AVERAGE:
+						Y = (Y_bwd[row + x] + Y_fwd[row + x] + 1) >> 1;
+						break;
+					}
 
-			++p_Y_MC;
-			++p_U_MC;
-			++p_V_MC;
+					int U, V;
+					PredictChroma(prediction, block_id, x, y, U, V);
+
+					cur_Y_MC[y * width + x] = static_cast<uint8>(Y);
+					cur_U_MC[y * width + x] = static_cast<int16>(U);
+					cur_V_MC[y * width + x] = static_cast<int16>(V);
+				}
+			}
 		}
 	}
 }
@@ -1019,7 +1348,7 @@ void FilterTemplate::MeasurePSNR() {
 	auto p_U_MC = cur_U_MC.get();
 	auto p_V_MC = cur_V_MC.get();
 
-	auto p_Y_cur = cur_Y.get() + width_ext * MotionEstimator::BORDER + MotionEstimator::BORDER;
+	auto p_Y_cur = cur_Y.get() + width_ext * border + border;
 	auto p_U_cur = cur_U.get();
 	auto p_V_cur = cur_V.get();
 
@@ -1042,7 +1371,7 @@ void FilterTemplate::MeasurePSNR() {
 			++p_V_cur;
 		}
 
-		p_Y_cur += 2 * MotionEstimator::BORDER;
+		p_Y_cur += 2 * border;
 	}
 
 	// Calculate PSNR.
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "global_motion.hpp"
+
+namespace {
+
+/// Number of rounds of fitting and picking the inliers
+constexpr int FIT_ROUNDS = 5;
+
+/// Inlier threshold in median residuals
+constexpr double RESIDUAL_SCALE = 3.0;
+
+/// Median of values, reorders them
+double Median(std::vector<double>& values) {
+	const auto middle = values.begin() + values.size() / 2;
+	std::nth_element(values.begin(), middle, values.end());
+	return *middle;
+}
+
+/**
+ * Solve the 3x3 symmetric system m * c = r by Cramer's rule
+ *
+ * @return false if the system is singular, as it is for collinear samples
+ */
+bool Solve3(const double (&m)[3][3], const double (&r)[3], double (&c)[3]) {
+	const auto det = [](const double (&n)[3][3]) {
+		return n[0][0] * (n[1][1] * n[2][2] - n[1][2] * n[2][1])
+		       - n[0][1] * (n[1][0] * n[2][2] - n[1][2] * n[2][0])
+		       + n[0][2] * (n[1][0] * n[2][1] - n[1][1] * n[2][0]);
+	};
+
+	const auto d = det(m);
+	if (std::abs(d) <= 1e-9 * std::abs(m[0][0] * m[1][1] * m[2][2]))
+		return false;
+
+	for (int k = 0; k < 3; ++k) {
+		double n[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				n[i][j] = (j == k) ? r[i] : m[i][j];
+
+		c[k] = det(n) / d;
+	}
+
+	return true;
+}
+
+}
+
+GlobalMotion::GlobalMotion() {
+	Reset();
+}
+
+void GlobalMotion::Reset() {
+	std::fill(a, a + 3, 0.0);
+	std::fill(b, b + 3, 0.0);
+	valid = false;
+}
+
+bool GlobalMotion::Fit(const Sample* samples, int count, double tolerance) {
+	Reset();
+
+	if (count == 0)
+		return false;
+
+	std::vector<double> values(count);
+
+	// Median translation, which ignores anything less than half of the frame
+	for (int i = 0; i < count; ++i)
+		values[i] = samples[i].vx;
+	a[0] = Median(values);
+
+	for (int i = 0; i < count; ++i)
+		values[i] = samples[i].vy;
+	b[0] = Median(values);
+
+	const auto residual = [&](const Sample& sample) {
+		return std::hypot(sample.vx - X(sample.x, sample.y), sample.vy - Y(sample.x, sample.y));
+	};
+
+	for (int round = 0; round < FIT_ROUNDS; ++round) {
+		for (int i = 0; i < count; ++i)
+			values[i] = residual(samples[i]);
+
+		const auto threshold = std::max(tolerance, RESIDUAL_SCALE * Median(values));
+
+		// Normal equations of the least squares fit of both components
+		double m[3][3] = {};
+		double rx[3] = {};
+		double ry[3] = {};
+
+		for (int i = 0; i < count; ++i) {
+			const auto& sample = samples[i];
+			if (residual(sample) > threshold)
+				continue;
+
+			const double p[3] = { 1.0, sample.x, sample.y };
+
+			for (int k = 0; k < 3; ++k) {
+				for (int l = 0; l < 3; ++l)
+					m[k][l] += p[k] * p[l];
+
+				rx[k] += p[k] * sample.vx;
+				ry[k] += p[k] * sample.vy;
+			}
+		}
+
+		if (m[0][0] == 0)
+			break;
+
+		// Too few or collinear inliers only give a translation.
+		if (!Solve3(m, rx, a) || !Solve3(m, ry, b)) {
+			a[0] = rx[0] / m[0][0];
+			b[0] = ry[0] / m[0][0];
+			a[1] = a[2] = b[1] = b[2] = 0;
+		}
+	}
+
+	const auto explained = std::count_if(samples, samples + count, [&](const Sample& sample) {
+		return residual(sample) <= tolerance;
+	});
+
+	valid = 2 * explained >= count;
+
+	return valid;
+}
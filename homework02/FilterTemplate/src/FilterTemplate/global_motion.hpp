@@ -0,0 +1,62 @@
+#pragma once
+
+/// Camera motion as an affine vector field: the vector at (x, y) is
+/// (a0 + a1 * x + a2 * y, b0 + b1 * x + b2 * y). It covers pans, zooms
+/// and rotations, and any translation or similarity is a special case.
+class GlobalMotion {
+public:
+	/// A vector of the field at a position
+	struct Sample {
+		/// Position relative to the frame center, in pixels
+		double x, y;
+
+		/// Vector in MV units
+		double vx, vy;
+	};
+
+	/// Constructor, the model is invalid until fitted
+	GlobalMotion();
+
+	/**
+	 * Fit the model to sample vectors, ignoring the ones that move on their own
+	 *
+	 * The fit starts from the median translation and alternates a least squares
+	 * fit of the inliers with a new inlier threshold, three times the median
+	 * residual but at least the tolerance. The model is valid if it explains
+	 * at least half of the samples within the tolerance.
+	 *
+	 * @param[in] samples sample vectors
+	 * @param[in] count number of samples
+	 * @param[in] tolerance largest distance to the model of a vector it explains, in MV units
+	 * @return whether the model is valid
+	 */
+	bool Fit(const Sample* samples, int count, double tolerance);
+
+	/// Forget the model
+	void Reset();
+
+	/// Whether the last fit explained most of the samples
+	inline bool IsValid() const {
+		return valid;
+	}
+
+	/// Horizontal component of the vector at a position relative to the frame center, in MV units
+	inline double X(double x, double y) const {
+		return a[0] + a[1] * x + a[2] * y;
+	}
+
+	/// Vertical component of the vector at a position relative to the frame center, in MV units
+	inline double Y(double x, double y) const {
+		return b[0] + b[1] * x + b[2] * y;
+	}
+
+private:
+	/// Coefficients of the horizontal component
+	double a[3];
+
+	/// Coefficients of the vertical component
+	double b[3];
+
+	/// Whether the model explains the samples it was fitted to
+	bool valid;
+};
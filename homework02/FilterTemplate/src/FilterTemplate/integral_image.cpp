@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#include "cpu.hpp"
+#include "integral_image.hpp"
+
+#if defined(ME_X86)
+#include <immintrin.h>
+#endif
+
+IntegralImage::IntegralImage(int width, int height)
+	: width(width)
+	, height(height)
+	, stride(width + 1)
+	, data(std::make_unique<uint32_t[]>((width + 1) * (height + 1))) {
+}
+
+void IntegralImage::Build(const uint8_t* plane, int plane_stride) {
+	// The first row and column stay zero after make_unique.
+	auto* prev_row = data.get();
+	auto* row = prev_row + stride;
+
+	for (int y = 0; y < height; ++y) {
+		uint32_t row_sum = 0;
+
+		for (int x = 0; x < width; ++x) {
+			row_sum += plane[x];
+			row[x + 1] = prev_row[x + 1] + row_sum;
+		}
+
+		plane += plane_stride;
+		prev_row = row;
+		row += stride;
+	}
+}
+
+long IntegralImage::GetQuadrantBound(int row, int col, int size, const long* cur_sums) const {
+	const auto half = size / 2;
+
+	// Differences of the table fit into 32 bits even when the table wraps around.
+	return std::labs(cur_sums[0] - static_cast<long>(Sum(row, col, half, half)))
+		+ std::labs(cur_sums[1] - static_cast<long>(Sum(row, col + half, half, half)))
+		+ std::labs(cur_sums[2] - static_cast<long>(Sum(row + half, col, half, half)))
+		+ std::labs(cur_sums[3] - static_cast<long>(Sum(row + half, col + half, half, half)));
+}
+
+int IntegralImage::GetCandidateMask_x8_C(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold) {
+	int mask = 0;
+
+	for (int i = 0; i < 8; ++i) {
+		if (image.GetQuadrantBound(row, col + i, size, cur_sums) < threshold)
+			mask |= 1 << i;
+	}
+
+	return mask;
+}
+
+#if defined(ME_X86)
+/// |a - b| for four 32-bit lanes
+ME_TARGET_SSE2
+static inline __m128i AbsDiff(const __m128i a, const __m128i b) {
+	const auto d = _mm_sub_epi32(a, b);
+	const auto sign = _mm_srai_epi32(d, 31);
+	return _mm_sub_epi32(_mm_xor_si128(d, sign), sign);
+}
+
+ME_TARGET_SSE2
+int IntegralImage::GetCandidateMask_x8_SSE2(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold) {
+	const auto half = size / 2;
+	const auto* top = image.data.get() + row * image.stride + col;
+	const auto limit = _mm_set1_epi32(static_cast<int>(std::min<long>(threshold, std::numeric_limits<int32_t>::max())));
+	int mask = 0;
+
+	// Four candidates per register; lane k belongs to the candidate at column col + k.
+	for (int k = 0; k < 8; k += 4) {
+		__m128i corners[3][3];
+
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				corners[r][c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + r * half * image.stride + c * half + k));
+
+		__m128i bound = _mm_setzero_si128();
+
+		for (int q = 0; q < 4; ++q) {
+			const auto r = q >> 1;
+			const auto c = q & 1;
+			const auto sum = _mm_add_epi32(_mm_sub_epi32(corners[r + 1][c + 1], corners[r + 1][c]),
+			                               _mm_sub_epi32(corners[r][c], corners[r][c + 1]));
+			bound = _mm_add_epi32(bound, AbsDiff(_mm_set1_epi32(static_cast<int>(cur_sums[q])), sum));
+		}
+
+		mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(bound, limit))) << k;
+	}
+
+	return mask;
+}
+
+ME_TARGET_AVX2
+int IntegralImage::GetCandidateMask_x8_AVX2(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold) {
+	const auto half = size / 2;
+	const auto* top = image.data.get() + row * image.stride + col;
+	const auto limit = _mm256_set1_epi32(static_cast<int>(std::min<long>(threshold, std::numeric_limits<int32_t>::max())));
+
+	__m256i corners[3][3];
+
+	for (int r = 0; r < 3; ++r)
+		for (int c = 0; c < 3; ++c)
+			corners[r][c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + r * half * image.stride + c * half));
+
+	__m256i bound = _mm256_setzero_si256();
+
+	for (int q = 0; q < 4; ++q) {
+		const auto r = q >> 1;
+		const auto c = q & 1;
+		const auto sum = _mm256_add_epi32(_mm256_sub_epi32(corners[r + 1][c + 1], corners[r + 1][c]),
+		                                  _mm256_sub_epi32(corners[r][c], corners[r][c + 1]));
+		bound = _mm256_add_epi32(bound, _mm256_abs_epi32(_mm256_sub_epi32(_mm256_set1_epi32(static_cast<int>(cur_sums[q])), sum)));
+	}
+
+	return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, bound)));
+}
+#endif
+
+IntegralImage::MaskFunc IntegralImage::SelectMaskKernel() {
+#if defined(ME_X86)
+	const auto& cpu = GetCpuFeatures();
+
+	if (cpu.avx2)
+		return GetCandidateMask_x8_AVX2;
+
+	if (cpu.sse2)
+		return GetCandidateMask_x8_SSE2;
+#endif
+
+	return GetCandidateMask_x8_C;
+}
+
+const IntegralImage::MaskFunc IntegralImage::mask_kernel = IntegralImage::SelectMaskKernel();
+
+void GetQuadrantSums(const uint8_t* block, int stride, int size, long* sums) {
+	const auto half = size / 2;
+
+	for (int q = 0; q < 4; ++q) {
+		const auto* p = block + (q >> 1) * half * stride + (q & 1) * half;
+		long sum = 0;
+
+		for (int y = 0; y < half; ++y, p += stride)
+			for (int x = 0; x < half; ++x)
+				sum += p[x];
+
+		sums[q] = sum;
+	}
+}
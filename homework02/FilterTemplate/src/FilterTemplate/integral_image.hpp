@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+/// Summed-area table of an 8-bit plane.
+/// Sums of any rectangle are read in constant time.
+class IntegralImage {
+public:
+	/// Constructor, allocates the table for a width x height plane
+	IntegralImage(int width, int height);
+
+	/**
+	 * Fill the table from a plane
+	 *
+	 * @param[in] plane array of width x height pixels with the given row stride
+	 * @param[in] stride row stride of the plane
+	 */
+	void Build(const uint8_t* plane, int stride);
+
+	/// Sum of the w x h rectangle with the top-left pixel at (row, col)
+	inline uint32_t Sum(int row, int col, int w, int h) const {
+		const auto* top = data.get() + row * stride + col;
+		const auto* bottom = top + h * stride;
+		return bottom[w] - bottom[0] - top[w] + top[0];
+	}
+
+	/**
+	 * Lower bound of SAD for a candidate block
+	 *
+	 * The bound is the sum of |sum(cur) - sum(ref)| over the four quadrants
+	 * of the block, which never exceeds the SAD of the block.
+	 *
+	 * @param[in] row row of the top-left pixel of the candidate
+	 * @param[in] col column of the top-left pixel of the candidate
+	 * @param[in] size block size
+	 * @param[in] cur_sums pixel sums of the current block quadrants,
+	 *   top-left, top-right, bottom-left, bottom-right
+	 */
+	long GetQuadrantBound(int row, int col, int size, const long* cur_sums) const;
+
+	/**
+	 * Select candidates worth a SAD evaluation among 8 blocks at consecutive columns
+	 *
+	 * @return bit mask where bit i is set if the lower bound of the candidate
+	 *   at column col + i is less than threshold
+	 */
+	inline int GetCandidateMask_x8(int row, int col, int size, const long* cur_sums, long threshold) const {
+		return mask_kernel(*this, row, col, size, cur_sums, threshold);
+	}
+
+private:
+	/// Plane width
+	int width;
+
+	/// Plane height
+	int height;
+
+	/// Table row stride, one more than the plane width
+	int stride;
+
+	/// (height + 1) x (width + 1) table, the first row and column are zero
+	std::unique_ptr<uint32_t[]> data;
+
+	using MaskFunc = int (*)(const IntegralImage&, int, int, int, const long*, long);
+
+	static int GetCandidateMask_x8_C(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold);
+	static int GetCandidateMask_x8_SSE2(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold);
+	static int GetCandidateMask_x8_AVX2(const IntegralImage& image, int row, int col, int size, const long* cur_sums, long threshold);
+	static MaskFunc SelectMaskKernel();
+
+	/// Fastest GetCandidateMask_x8() implementation for the host CPU
+	static const MaskFunc mask_kernel;
+};
+
+/// Pixel sums of the four quadrants of a size x size block, in GetQuadrantBound() order
+void GetQuadrantSums(const uint8_t* block, int stride, int size, long* sums);
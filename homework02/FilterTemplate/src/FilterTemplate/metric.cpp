@@ -1,199 +1,1172 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "cpu.hpp"
 #include "metric.hpp"
 
-long GetErrorSAD_16x16(const uint8_t* block1, const uint8_t* block2, const int stride)
+#if defined(ME_X86)
+#include <immintrin.h>
+#endif
+
+// Scalar kernels, used when no SIMD extension is available.
+
+template<int W, int H>
+static long GetErrorSAD_C(const uint8_t* block1, const uint8_t* block2, const int stride)
 {
     long sum = 0;
-    short m[4] = {1,1,1,1};
-    int b1 = (int)block1;
-    int b2 = (int)block2;
-    __asm
+
+    for (int y = 0; y < H; ++y)
     {
-        push edi
-        push esi
+        for (int x = 0; x < W; ++x)
+            sum += std::abs(block1[x] - block2[x]);
 
-        mov esi, b1//[esp + 8 + 4]    ; Current MB (Estimated MB)
-        mov edi, b2//[esp + 8 + 12]    ; reference MB
-        mov eax, stride//[esp + 8 + 20]    ; stride
+        block1 += stride;
+        block2 += stride;
+    }
 
-        pxor mm7, mm7            ; mm7 = sum = 0
-        pxor mm6, mm6            ; mm6 = 0
+    return sum;
+}
 
-        movq mm1, [esi]            ; 8 pixels for current MB
-        movq mm3, [esi+8]        ; another 8 pixels in the same row of current MB
+template<int W, int H>
+static long GetErrorSAD_Threshold_C(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
+{
+    long sum = 0;
 
-        mov    ecx, 16
-        //mov    ecx, 8
+    for (int y = 0; y < H; ++y)
+    {
+        for (int x = 0; x < W; ++x)
+            sum += std::abs(block1[x] - block2[x]);
 
-sad16_mmx_loop:
-        movq mm0, [edi]            ; 8 pixels for reference MB
-        movq mm2, [edi+8]        ; another 8 pixels in the same row of reference MB
+        if ((y & 3) == 3 && sum > threshold)
+            return sum;
 
-        movq mm4, mm1
-        movq mm5, mm3
+        block1 += stride;
+        block2 += stride;
+    }
 
-        psubusb mm1, mm0
-        psubusb mm3, mm2
+    return sum;
+}
 
-        add    esi, eax
-        add    edi, eax
+template<int W, int H>
+static void GetErrorSAD_x8_C(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    for (int i = 0; i < 8; ++i)
+        errors[i] = GetErrorSAD_Threshold_C<W, H>(block1, block2 + i, stride, threshold);
+}
 
-        psubusb mm0, mm4
-        psubusb mm2, mm5
+static void GetErrorSAD_16x16_Quadrants_x8_C(const uint8_t* block1, const uint8_t* block2, const int stride, long (*errors)[8])
+{
+    for (int h = 0; h < 4; ++h)
+    {
+        const int offset = ((h > 1) ? 8 * stride : 0) + ((h & 1) ? 8 : 0);
+        GetErrorSAD_x8_C<8, 8>(block1 + offset, block2 + offset, stride, errors[h], std::numeric_limits<long>::max());
+    }
+}
 
-        por mm0, mm1            ; mm0 = |cur - ref|
-        por mm2, mm3            ; mm2 = |*(cur+8) - *(ref+8)|
+static void GetErrorSAD_16x16_Blocks_C(const uint8_t* block1, const uint8_t* block2, const int stride, const int count, long* errors)
+{
+    for (int i = 0; i < count; ++i)
+        errors[i] = GetErrorSAD_C<16, 16>(block1 + 16 * i, block2 + 16 * i, stride);
+}
 
-        movq mm1,mm0
-        movq mm3,mm2
+/// In-place unnormalized Hadamard transform of N values with the given step
+template<int N>
+static void Hadamard_C(int* v, const int step)
+{
+    for (int d = N / 2; d > 0; d /= 2)
+    {
+        for (int i = 0; i < N; ++i)
+        {
+            if (i & d)
+                continue;
 
-        punpcklbw mm0,mm6
-        punpckhbw mm1,mm6
+            const int a = v[i * step];
+            const int b = v[(i + d) * step];
+            v[i * step] = a + b;
+            v[(i + d) * step] = a - b;
+        }
+    }
+}
 
-        punpcklbw mm2,mm6
-        punpckhbw mm3,mm6
+/// Sum of absolute Hadamard coefficients of the NxN difference block.
+/// Dividing it by N gives the sum for the orthonormal transform.
+template<int N>
+static long HadamardSum_C(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    int d[N * N];
 
-        paddusw mm0,mm1
-        paddusw mm2,mm3
+    for (int y = 0; y < N; ++y)
+        for (int x = 0; x < N; ++x)
+            d[y * N + x] = block1[y * stride + x] - block2[y * stride + x];
 
-        paddusw mm7,mm0        ; sum += mm01
-        movq mm1, [esi]        ; 8 pixels for current MB
+    for (int i = 0; i < N; ++i)
+        Hadamard_C<N>(d + i * N, 1);
 
-        paddusw mm7,mm2        ; sum += mm23
-        movq mm3, [esi+8]    ; another 8 pixels in the same row of current MB
+    for (int i = 0; i < N; ++i)
+        Hadamard_C<N>(d + i, N);
 
-        ;// start next row's processing
-        movq mm0, [edi]            ; 8 pixels for reference MB
-        movq mm2, [edi+8]        ; another 8 pixels in the same row of reference MB
+    long sum = 0;
+    for (int i = 0; i < N * N; ++i)
+        sum += std::abs(d[i]);
 
-        movq mm4, mm1
-        movq mm5, mm3
+    return sum;
+}
 
-        psubusb mm1, mm0
-        psubusb mm3, mm2
+static long GetErrorSATD_4x4_C(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return (HadamardSum_C<4>(block1, block2, stride) + 2) >> 2;
+}
 
-        add    esi, eax
-        add    edi, eax
+static long GetErrorSATD_8x8_C(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return (HadamardSum_C<8>(block1, block2, stride) + 4) >> 3;
+}
 
-        psubusb mm0, mm4
-        psubusb mm2, mm5
+/// 16x16 SATD as the sum of four 8x8 SATDs
+template<long (*SATD_8x8)(const uint8_t*, const uint8_t*, int)>
+static long GetErrorSATD_16x16_Quad(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return SATD_8x8(block1, block2, stride)
+        + SATD_8x8(block1 + 8, block2 + 8, stride)
+        + SATD_8x8(block1 + 8 * stride, block2 + 8 * stride, stride)
+        + SATD_8x8(block1 + 8 * stride + 8, block2 + 8 * stride + 8, stride);
+}
 
-        por mm0, mm1            ; mm0 = |cur - ref|
-        por mm2, mm3            ; mm2 = |*(cur+8) - *(ref+8)|
+#if defined(ME_X86)
 
-        movq mm1,mm0
-        movq mm3,mm2
+// SSE2 kernels. psadbw sums |a - b| over 8 bytes into a 64-bit lane,
+// so the accumulators cannot saturate.
 
-        punpcklbw mm0,mm6
-        punpckhbw mm1,mm6
+// Shape-generic SAD. SADRows_SSE2<W> sums ROWS rows of a W pixel wide block;
+// all trip counts are compile-time constants, so the loops unroll completely.
 
-        punpcklbw mm2,mm6
-        punpckhbw mm3,mm6
+template<int W>
+struct SADRows_SSE2
+{
+    static_assert(W % 16 == 0, "block width must be 4, 8 or a multiple of 16");
+    static constexpr int ROWS = 1;
 
-        paddusw mm0,mm1
-        paddusw mm2,mm3
+    ME_TARGET_SSE2
+    static inline __m128i Sum(const uint8_t* block1, const uint8_t* block2, const int)
+    {
+        __m128i sum = _mm_setzero_si128();
 
-        paddusw mm7,mm0        ; sum += mm01
-        movq mm1, [esi]        ; 8 pixels for current MB
+        for (int x = 0; x < W; x += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1 + x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2 + x));
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(a, b));
+        }
 
-        paddusw mm7,mm2        ; sum += mm23
-        sub        ecx, 2        ; unlooped two rows processing
+        return sum;
+    }
+};
 
-        movq mm3, [esi+8]    ; another 8 pixels in the same row of current MB
+template<>
+struct SADRows_SSE2<8>
+{
+    static constexpr int ROWS = 2;
 
-        jnz    sad16_mmx_loop
+    // Two rows of 8 pixels per register.
+    ME_TARGET_SSE2
+    static inline __m128i Sum(const uint8_t* block1, const uint8_t* block2, const int stride)
+    {
+        const __m128i a = _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + stride)));
+        const __m128i b = _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + stride)));
 
-        pmaddwd mm7, m    ; merge sum
-        pop     esi
+        return _mm_sad_epu8(a, b);
+    }
+};
 
-        movq mm0, mm7
-        pop     edi
-        psrlq mm7, 32
+template<>
+struct SADRows_SSE2<4>
+{
+    static constexpr int ROWS = 4;
 
-        paddd mm0, mm7
-        movd sum, mm0
+    // Two rows of 4 pixels in the low half of a register.
+    ME_TARGET_SSE2
+    static inline __m128i Load(const uint8_t* block, const int stride)
+    {
+        int32_t row0;
+        int32_t row1;
+        std::memcpy(&row0, block, sizeof(row0));
+        std::memcpy(&row1, block + stride, sizeof(row1));
 
-        emms
+        return _mm_unpacklo_epi32(_mm_cvtsi32_si128(row0), _mm_cvtsi32_si128(row1));
     }
-    return sum;
+
+    // Four rows of 4 pixels per register.
+    ME_TARGET_SSE2
+    static inline __m128i Sum(const uint8_t* block1, const uint8_t* block2, const int stride)
+    {
+        const __m128i a = _mm_unpacklo_epi64(Load(block1, stride), Load(block1 + 2 * stride, stride));
+        const __m128i b = _mm_unpacklo_epi64(Load(block2, stride), Load(block2 + 2 * stride, stride));
+
+        return _mm_sad_epu8(a, b);
+    }
+};
+
+template<int W, int H>
+ME_TARGET_SSE2
+static long GetErrorSAD_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    using Rows = SADRows_SSE2<W>;
+    static_assert(H % Rows::ROWS == 0, "block height must be a multiple of the row group");
+
+    __m128i sum = _mm_setzero_si128();
+
+    for (int y = 0; y < H; y += Rows::ROWS)
+    {
+        sum = _mm_add_epi32(sum, Rows::Sum(block1, block2, stride));
+
+        block1 += Rows::ROWS * stride;
+        block2 += Rows::ROWS * stride;
+    }
+
+    return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
 }
 
-long GetErrorSAD_8x8(const uint8_t* block1, const uint8_t *block2, const int stride)
+// Threshold variants check the partial sum every four rows.
+
+ME_TARGET_SSE2
+static long GetErrorSAD_16x16_Threshold_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
 {
-    long sum = 0;
-    short m[4] = {1,1,1,1};
-    int b1 = (int)block1;
-    int b2 = (int)block2;
-    __asm
+    __m128i sum = _mm_setzero_si128();
+
+    for (int y = 0; y < 16; y += 4)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2));
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(a, b));
+
+            block1 += stride;
+            block2 += stride;
+        }
+
+        const long partial = _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_srli_si128(sum, 8)));
+        if (partial > threshold)
+            return partial;
+    }
+
+    return _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_srli_si128(sum, 8)));
+}
+
+ME_TARGET_SSE2
+static long GetErrorSAD_8x8_Threshold_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
+{
+    __m128i sum = _mm_setzero_si128();
+
+    for (int y = 0; y < 8; y += 4)
+    {
+        for (int k = 0; k < 4; k += 2)
+        {
+            const __m128i a = _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1)),
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + stride)));
+            const __m128i b = _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2)),
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + stride)));
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(a, b));
+
+            block1 += 2 * stride;
+            block2 += 2 * stride;
+        }
+
+        const long partial = _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_srli_si128(sum, 8)));
+        if (partial > threshold)
+            return partial;
+    }
+
+    return _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_srli_si128(sum, 8)));
+}
+
+// Sliding psadbw: every current row is loaded once and compared
+// against eight consecutive reference positions.
+
+/// Store eight psadbw accumulators and return the smallest of them
+ME_TARGET_SSE2
+static inline long StorePartialErrors(const __m128i* sum, long* errors)
+{
+    long min_error = std::numeric_limits<long>::max();
+
+    for (int i = 0; i < 8; ++i)
+    {
+        errors[i] = _mm_cvtsi128_si32(_mm_add_epi32(sum[i], _mm_srli_si128(sum[i], 8)));
+        min_error = std::min(min_error, errors[i]);
+    }
+
+    return min_error;
+}
+
+ME_TARGET_SSE2
+static void GetErrorSAD_16x16_x8_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m128i sum[8];
+    for (int i = 0; i < 8; ++i)
+        sum[i] = _mm_setzero_si128();
+
+    for (int y = 0; y < 16; ++y)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1));
+
+        for (int i = 0; i < 8; ++i)
+        {
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2 + i));
+            sum[i] = _mm_add_epi32(sum[i], _mm_sad_epu8(a, b));
+        }
+
+        block1 += stride;
+        block2 += stride;
+
+        if ((y & 3) == 3 && y != 15 && StorePartialErrors(sum, errors) > threshold)
+            return;
+    }
+
+    StorePartialErrors(sum, errors);
+}
+
+ME_TARGET_SSE2
+static void GetErrorSAD_8x8_x8_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m128i sum[8];
+    for (int i = 0; i < 8; ++i)
+        sum[i] = _mm_setzero_si128();
+
+    for (int y = 0; y < 8; y += 2)
     {
-        push edi
-        push esi
+        const __m128i a = _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + stride)));
 
-        mov esi, b1//[esp + 8 + 4]    ; Current MB (Estimated MB)
-        mov edi, b2//[esp + 8 + 12]    ; reference MB
-        mov eax, stride//[esp + 8 + 20]    ; stride
+        for (int i = 0; i < 8; ++i)
+        {
+            const __m128i b = _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + i)),
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + i + stride)));
+            sum[i] = _mm_add_epi32(sum[i], _mm_sad_epu8(a, b));
+        }
 
-        pxor    mm6, mm6            ; mm6 = sum = 0
+        block1 += 2 * stride;
+        block2 += 2 * stride;
 
-        pxor    mm7, mm7            ; mm7 = 0
-        mov        ecx, 4
+        if (y == 2 && StorePartialErrors(sum, errors) > threshold)
+            return;
+    }
+
+    StorePartialErrors(sum, errors);
+}
 
-sad8_mmx_lp:
+/// psadbw sums the left and the right eight pixels separately, which are the left and right quadrants
+ME_TARGET_SSE2
+static void GetErrorSAD_16x16_Quadrants_x8_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, long (*errors)[8])
+{
+    for (int half = 0; half < 2; ++half)
+    {
+        __m128i sum[8];
+        for (int i = 0; i < 8; ++i)
+            sum[i] = _mm_setzero_si128();
 
-        movq mm0, [esi]    ; ref
-        movq mm1, [edi]    ; cur
+        for (int y = 0; y < 8; ++y)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1));
 
-        add    esi, eax
-        add    edi, eax
+            for (int i = 0; i < 8; ++i)
+            {
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2 + i));
+                sum[i] = _mm_add_epi32(sum[i], _mm_sad_epu8(a, b));
+            }
 
-        movq mm2, [esi]    ; ref2
-        movq mm3, [edi]    ; cur2
+            block1 += stride;
+            block2 += stride;
+        }
 
-        movq mm4, mm0
-        movq mm5, mm2
+        for (int i = 0; i < 8; ++i)
+        {
+            errors[2 * half][i] = _mm_cvtsi128_si32(sum[i]);
+            errors[2 * half + 1][i] = _mm_cvtsi128_si32(_mm_srli_si128(sum[i], 8));
+        }
+    }
+}
 
-        psubusb mm0, mm1
-        psubusb mm2, mm3
+/// Up to 8 blocks side by side are summed row by row, so each row of the frame is read in one pass
+ME_TARGET_SSE2
+static void GetErrorSAD_16x16_Blocks_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride, const int count, long* errors)
+{
+    for (int i = 0; i < count; i += 8)
+    {
+        const int n = std::min(8, count - i);
 
-        psubusb mm1, mm4
-        psubusb mm3, mm5
+        __m128i sum[8];
+        for (int k = 0; k < n; ++k)
+            sum[k] = _mm_setzero_si128();
 
-        por mm0, mm1            ; mm0 = |ref - cur|
-        por mm2, mm3            ; mm2 = |*(ref+stride) - *(cur+stride)|
+        for (int y = 0; y < 16; ++y)
+        {
+            const uint8_t* row1 = block1 + y * stride + 16 * i;
+            const uint8_t* row2 = block2 + y * stride + 16 * i;
 
-        movq mm1,mm0
-        movq mm3,mm2
+            for (int k = 0; k < n; ++k)
+            {
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 16 * k));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row2 + 16 * k));
+                sum[k] = _mm_add_epi32(sum[k], _mm_sad_epu8(a, b));
+            }
+        }
 
-        punpcklbw mm0,mm7
-        punpcklbw mm2,mm7
+        for (int k = 0; k < n; ++k)
+            errors[i + k] = _mm_cvtsi128_si32(_mm_add_epi32(sum[k], _mm_srli_si128(sum[k], 8)));
+    }
+}
 
-        punpckhbw mm1,mm7
-        punpckhbw mm3,mm7
+// SSE4.1 kernels based on mpsadbw, which computes eight 4-pixel SADs at
+// consecutive offsets in one instruction. The 16-bit lanes hold at most
+// 16 * 16 * 255 = 65280 and do not overflow.
 
-        paddusw mm0,mm1
-        paddusw mm2,mm3
+/// Load reference pixels [8, 23) of a row into bytes [0, 15) without reading past them
+ME_TARGET_SSE41
+static inline __m128i LoadRefHigh(const uint8_t* row)
+{
+    return _mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 7)), 1);
+}
 
-        paddusw mm6,mm0            ; sum += mm01
-        add    esi, eax
+/// Load reference pixels [0, 15) of a row without reading past them
+ME_TARGET_SSE41
+static inline __m128i LoadRefLow(const uint8_t* row)
+{
+    return _mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row)),
+        _mm_srli_si128(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + 7)), 1));
+}
 
-        add    edi, eax
-        paddusw mm6,mm2            ; sum += mm23
+/// Smallest of eight 16-bit SADs
+ME_TARGET_SSE41
+static inline long MinError(const __m128i sum)
+{
+    return _mm_cvtsi128_si32(_mm_minpos_epu16(sum)) & 0xFFFF;
+}
 
-        dec    ecx
-        jnz    sad8_mmx_lp
+ME_TARGET_SSE41
+static inline void StoreErrors(const __m128i sum, long* errors)
+{
+    alignas(16) uint16_t out[8];
+    _mm_store_si128(reinterpret_cast<__m128i*>(out), sum);
 
-        pmaddwd mm6, m    ; merge sum
-        pop     esi
+    for (int i = 0; i < 8; ++i)
+        errors[i] = out[i];
+}
 
-        movq mm7, mm6
-        pop     edi
+ME_TARGET_SSE41
+static void GetErrorSAD_16x16_x8_SSE41(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m128i sum = _mm_setzero_si128();
 
-        psrlq mm7, 32
+    for (int y = 0; y < 16; ++y)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1));
+        const __m128i b_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2));
+        const __m128i b_hi = LoadRefHigh(block2);
 
-        paddd mm6, mm7
+        // Current pixels [0, 4), [4, 8) against the reference from offset 0 and 4,
+        // current pixels [8, 12), [12, 16) against the reference from offset 8 and 12.
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b_lo, a, 0));
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b_lo, a, 5));
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b_hi, a, 2));
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b_hi, a, 7));
 
-        movd sum, mm6
+        block1 += stride;
+        block2 += stride;
 
-        emms
+        if ((y & 3) == 3 && MinError(sum) > threshold)
+            break;
     }
+
+    StoreErrors(sum, errors);
+}
+
+ME_TARGET_SSE41
+static void GetErrorSAD_8x8_x8_SSE41(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m128i sum = _mm_setzero_si128();
+
+    for (int y = 0; y < 8; ++y)
+    {
+        const __m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1));
+        const __m128i b = LoadRefLow(block2);
+
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b, a, 0));
+        sum = _mm_add_epi16(sum, _mm_mpsadbw_epu8(b, a, 5));
+
+        block1 += stride;
+        block2 += stride;
+
+        if (y == 3 && MinError(sum) > threshold)
+            break;
+    }
+
+    StoreErrors(sum, errors);
+}
+
+ME_TARGET_SSE41
+static void GetErrorSAD_16x16_Quadrants_x8_SSE41(const uint8_t* block1, const uint8_t* block2, const int stride, long (*errors)[8])
+{
+    for (int half = 0; half < 2; ++half)
+    {
+        __m128i left = _mm_setzero_si128();
+        __m128i right = _mm_setzero_si128();
+
+        for (int y = 0; y < 8; ++y)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1));
+            const __m128i b_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2));
+            const __m128i b_hi = LoadRefHigh(block2);
+
+            left = _mm_add_epi16(left, _mm_mpsadbw_epu8(b_lo, a, 0));
+            left = _mm_add_epi16(left, _mm_mpsadbw_epu8(b_lo, a, 5));
+            right = _mm_add_epi16(right, _mm_mpsadbw_epu8(b_hi, a, 2));
+            right = _mm_add_epi16(right, _mm_mpsadbw_epu8(b_hi, a, 7));
+
+            block1 += stride;
+            block2 += stride;
+        }
+
+        StoreErrors(left, errors[2 * half]);
+        StoreErrors(right, errors[2 * half + 1]);
+    }
+}
+
+// AVX2 kernels, processing two (16x16) or four (8x8) rows per instruction.
+
+ME_TARGET_AVX2
+static inline __m256i LoadRows16(const uint8_t* row0, const uint8_t* row1)
+{
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1)),
+        1);
+}
+
+ME_TARGET_AVX2
+static inline __m256i LoadRows8(const uint8_t* block, const int stride)
+{
+    const __m128i lo = _mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block)),
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + stride)));
+    const __m128i hi = _mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + 2 * stride)),
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + 3 * stride)));
+
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+ME_TARGET_AVX2
+static inline long HorizontalSum(const __m256i sum)
+{
+    const __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+}
+
+// Shape-generic SAD, see SADRows_SSE2. Blocks 4 pixels wide gain nothing
+// from 256-bit registers and use the SSE2 kernel.
+
+template<int W>
+struct SADRows_AVX2
+{
+    static_assert(W % 32 == 0, "block width must be 8, 16 or a multiple of 32");
+    static constexpr int ROWS = 1;
+
+    ME_TARGET_AVX2
+    static inline __m256i Sum(const uint8_t* block1, const uint8_t* block2, const int)
+    {
+        __m256i sum = _mm256_setzero_si256();
+
+        for (int x = 0; x < W; x += 32)
+        {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block1 + x));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block2 + x));
+            sum = _mm256_add_epi32(sum, _mm256_sad_epu8(a, b));
+        }
+
+        return sum;
+    }
+};
+
+template<>
+struct SADRows_AVX2<16>
+{
+    static constexpr int ROWS = 2;
+
+    ME_TARGET_AVX2
+    static inline __m256i Sum(const uint8_t* block1, const uint8_t* block2, const int stride)
+    {
+        return _mm256_sad_epu8(LoadRows16(block1, block1 + stride), LoadRows16(block2, block2 + stride));
+    }
+};
+
+template<>
+struct SADRows_AVX2<8>
+{
+    static constexpr int ROWS = 4;
+
+    ME_TARGET_AVX2
+    static inline __m256i Sum(const uint8_t* block1, const uint8_t* block2, const int stride)
+    {
+        return _mm256_sad_epu8(LoadRows8(block1, stride), LoadRows8(block2, stride));
+    }
+};
+
+template<int W, int H>
+ME_TARGET_AVX2
+static long GetErrorSAD_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    using Rows = SADRows_AVX2<W>;
+    static_assert(H % Rows::ROWS == 0, "block height must be a multiple of the row group");
+
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int y = 0; y < H; y += Rows::ROWS)
+    {
+        sum = _mm256_add_epi32(sum, Rows::Sum(block1, block2, stride));
+
+        block1 += Rows::ROWS * stride;
+        block2 += Rows::ROWS * stride;
+    }
+
+    return HorizontalSum(sum);
+}
+
+ME_TARGET_AVX2
+static long GetErrorSAD_16x16_Threshold_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
+{
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int y = 0; y < 16; y += 4)
+    {
+        const __m256i a0 = LoadRows16(block1, block1 + stride);
+        const __m256i b0 = LoadRows16(block2, block2 + stride);
+        const __m256i a1 = LoadRows16(block1 + 2 * stride, block1 + 3 * stride);
+        const __m256i b1 = LoadRows16(block2 + 2 * stride, block2 + 3 * stride);
+        sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_sad_epu8(a0, b0), _mm256_sad_epu8(a1, b1)));
+
+        block1 += 4 * stride;
+        block2 += 4 * stride;
+
+        const long partial = HorizontalSum(sum);
+        if (partial > threshold)
+            return partial;
+    }
+
+    return HorizontalSum(sum);
+}
+
+// AVX2 mpsadbw works on each 128-bit lane separately, so every instruction
+// handles two rows with the same offsets in the low and the high lane.
+
+ME_TARGET_AVX2
+static inline __m256i Combine(const __m128i lo, const __m128i hi)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+/// Add the row sums of the high lane to the low lane
+ME_TARGET_AVX2
+static inline __m128i FoldLanes(const __m256i sum)
+{
+    return _mm_add_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+}
+
+ME_TARGET_AVX2
+static void GetErrorSAD_16x16_x8_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int y = 0; y < 16; y += 2)
+    {
+        const __m256i a = LoadRows16(block1, block1 + stride);
+        const __m256i b_lo = LoadRows16(block2, block2 + stride);
+        const __m256i b_hi = Combine(LoadRefHigh(block2), LoadRefHigh(block2 + stride));
+
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b_lo, a, 0 | (0 << 3)));
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b_lo, a, 5 | (5 << 3)));
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b_hi, a, 2 | (2 << 3)));
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b_hi, a, 7 | (7 << 3)));
+
+        block1 += 2 * stride;
+        block2 += 2 * stride;
+
+        if ((y & 3) == 2 && MinError(FoldLanes(sum)) > threshold)
+            break;
+    }
+
+    StoreErrors(FoldLanes(sum), errors);
+}
+
+ME_TARGET_AVX2
+static void GetErrorSAD_8x8_x8_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int y = 0; y < 8; y += 2)
+    {
+        const __m256i a = Combine(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1)),
+                                  _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + stride)));
+        const __m256i b = Combine(LoadRefLow(block2), LoadRefLow(block2 + stride));
+
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b, a, 0 | (0 << 3)));
+        sum = _mm256_add_epi16(sum, _mm256_mpsadbw_epu8(b, a, 5 | (5 << 3)));
+
+        block1 += 2 * stride;
+        block2 += 2 * stride;
+
+        if (y == 2 && MinError(FoldLanes(sum)) > threshold)
+            break;
+    }
+
+    StoreErrors(FoldLanes(sum), errors);
+}
+
+/// Two blocks per load, 8 blocks per pass; the rest goes to the SSE2 kernel
+ME_TARGET_AVX2
+static void GetErrorSAD_16x16_Blocks_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride, const int count, long* errors)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i sum[4];
+        for (int k = 0; k < 4; ++k)
+            sum[k] = _mm256_setzero_si256();
+
+        for (int y = 0; y < 16; ++y)
+        {
+            const uint8_t* row1 = block1 + y * stride + 16 * i;
+            const uint8_t* row2 = block2 + y * stride + 16 * i;
+
+            for (int k = 0; k < 4; ++k)
+            {
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 32 * k));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row2 + 32 * k));
+                sum[k] = _mm256_add_epi32(sum[k], _mm256_sad_epu8(a, b));
+            }
+        }
+
+        for (int k = 0; k < 4; ++k)
+        {
+            const __m128i lo = _mm256_castsi256_si128(sum[k]);
+            const __m128i hi = _mm256_extracti128_si256(sum[k], 1);
+
+            errors[i + 2 * k] = _mm_cvtsi128_si32(_mm_add_epi32(lo, _mm_srli_si128(lo, 8)));
+            errors[i + 2 * k + 1] = _mm_cvtsi128_si32(_mm_add_epi32(hi, _mm_srli_si128(hi, 8)));
+        }
+    }
+
+    if (i < count)
+        GetErrorSAD_16x16_Blocks_SSE2(block1 + 16 * i, block2 + 16 * i, stride, count - i, errors + i);
+}
+
+// SATD kernels. Differences are transformed in 16-bit lanes: the largest
+// 8x8 Hadamard coefficient is 64 * 255 = 16320, which fits. The vertical
+// transform is a butterfly between row registers, the horizontal one is done
+// inside each register with shuffles. Some coefficients come out negated,
+// which does not change their absolute value.
+
+/// Butterfly stage within a register: lanes selected by mask get a - b, the others a + b
+ME_TARGET_SSE2
+static inline __m128i HadamardStage(const __m128i a, const __m128i b, const __m128i mask)
+{
+    return _mm_or_si128(_mm_andnot_si128(mask, _mm_add_epi16(a, b)),
+                        _mm_and_si128(mask, _mm_sub_epi16(a, b)));
+}
+
+/// 4-point horizontal Hadamard transform of each 4-lane group
+ME_TARGET_SSE2
+static inline __m128i Hadamard4Horizontal(__m128i v)
+{
+    const __m128i mask2 = _mm_set_epi16(-1, -1, 0, 0, -1, -1, 0, 0);
+    const __m128i mask1 = _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+
+    v = HadamardStage(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), mask2);
+    v = HadamardStage(v, _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1)), mask1);
+
+    return v;
+}
+
+/// 8-point horizontal Hadamard transform of each 8-lane row
+ME_TARGET_SSE2
+static inline __m128i Hadamard8Horizontal(__m128i v)
+{
+    const __m128i mask4 = _mm_set_epi16(-1, -1, -1, -1, 0, 0, 0, 0);
+
+    v = HadamardStage(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), mask4);
+
+    return Hadamard4Horizontal(v);
+}
+
+ME_TARGET_SSE2
+static inline __m128i AbsSum(const __m128i sum, const __m128i v)
+{
+    const __m128i abs = _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+    return _mm_add_epi32(sum, _mm_madd_epi16(abs, _mm_set1_epi16(1)));
+}
+
+ME_TARGET_SSE2
+static inline long HorizontalSum(const __m128i sum)
+{
+    const __m128i s = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtsi128_si32(_mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+ME_TARGET_SSE2
+static inline __m128i Load4(const uint8_t* p)
+{
+    int32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+ME_TARGET_SSE2
+static long GetErrorSATD_4x4_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    // Rows 0 and 1 in the first register, rows 2 and 3 in the second one.
+    const __m128i a01 = _mm_unpacklo_epi8(_mm_unpacklo_epi32(Load4(block1), Load4(block1 + stride)), zero);
+    const __m128i a23 = _mm_unpacklo_epi8(_mm_unpacklo_epi32(Load4(block1 + 2 * stride), Load4(block1 + 3 * stride)), zero);
+    const __m128i b01 = _mm_unpacklo_epi8(_mm_unpacklo_epi32(Load4(block2), Load4(block2 + stride)), zero);
+    const __m128i b23 = _mm_unpacklo_epi8(_mm_unpacklo_epi32(Load4(block2 + 2 * stride), Load4(block2 + 3 * stride)), zero);
+
+    const __m128i d01 = _mm_sub_epi16(a01, b01);
+    const __m128i d23 = _mm_sub_epi16(a23, b23);
+
+    // Vertical transform: rows (0 + 2 | 1 + 3) and (0 - 2 | 1 - 3), then combine the halves.
+    const __m128i s = _mm_add_epi16(d01, d23);
+    const __m128i d = _mm_sub_epi16(d01, d23);
+    const __m128i lo = _mm_unpacklo_epi64(s, d);
+    const __m128i hi = _mm_unpackhi_epi64(s, d);
+
+    __m128i sum = AbsSum(_mm_setzero_si128(), Hadamard4Horizontal(_mm_add_epi16(lo, hi)));
+    sum = AbsSum(sum, Hadamard4Horizontal(_mm_sub_epi16(lo, hi)));
+
+    return (HorizontalSum(sum) + 2) >> 2;
+}
+
+ME_TARGET_SSE2
+static long GetErrorSATD_8x8_SSE2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r[8];
+
+    for (int y = 0; y < 8; ++y)
+    {
+        const __m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + y * stride));
+        const __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + y * stride));
+        r[y] = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    }
+
+    for (int d = 4; d > 0; d /= 2)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            if (i & d)
+                continue;
+
+            const __m128i a = r[i];
+            const __m128i b = r[i + d];
+            r[i] = _mm_add_epi16(a, b);
+            r[i + d] = _mm_sub_epi16(a, b);
+        }
+    }
+
+    __m128i sum = zero;
+    for (int y = 0; y < 8; ++y)
+        sum = AbsSum(sum, Hadamard8Horizontal(r[y]));
+
+    return (HorizontalSum(sum) + 4) >> 3;
+}
+
+// AVX2 SATD transforms two horizontally adjacent 8x8 blocks at once,
+// one per 128-bit lane, since in-lane shuffles match the SSE2 ones.
+
+ME_TARGET_AVX2
+static inline __m256i HadamardStage(const __m256i a, const __m256i b, const __m256i mask)
+{
+    return _mm256_blendv_epi8(_mm256_add_epi16(a, b), _mm256_sub_epi16(a, b), mask);
+}
+
+ME_TARGET_AVX2
+static inline __m256i Hadamard8Horizontal(__m256i v)
+{
+    const __m256i mask4 = _mm256_set_epi16(-1, -1, -1, -1, 0, 0, 0, 0, -1, -1, -1, -1, 0, 0, 0, 0);
+    const __m256i mask2 = _mm256_set_epi16(-1, -1, 0, 0, -1, -1, 0, 0, -1, -1, 0, 0, -1, -1, 0, 0);
+    const __m256i mask1 = _mm256_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0);
+
+    v = HadamardStage(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), mask4);
+    v = HadamardStage(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), mask2);
+    v = HadamardStage(v, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1)), mask1);
+
+    return v;
+}
+
+/// Hadamard sums of two adjacent 8x8 blocks, returned per 128-bit lane
+ME_TARGET_AVX2
+static inline __m256i HadamardSum_16x8_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    __m256i r[8];
+
+    for (int y = 0; y < 8; ++y)
+    {
+        const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block1 + y * stride)));
+        const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block2 + y * stride)));
+        r[y] = _mm256_sub_epi16(a, b);
+    }
+
+    for (int d = 4; d > 0; d /= 2)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            if (i & d)
+                continue;
+
+            const __m256i a = r[i];
+            const __m256i b = r[i + d];
+            r[i] = _mm256_add_epi16(a, b);
+            r[i + d] = _mm256_sub_epi16(a, b);
+        }
+    }
+
+    __m256i sum = _mm256_setzero_si256();
+    for (int y = 0; y < 8; ++y)
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_abs_epi16(Hadamard8Horizontal(r[y])), _mm256_set1_epi16(1)));
+
     return sum;
 }
+
+ME_TARGET_AVX2
+static long GetErrorSATD_16x16_AVX2(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    // Every 8x8 sum is normalized and rounded separately to match the 8x8 kernel.
+    const __m256i top = HadamardSum_16x8_AVX2(block1, block2, stride);
+    const __m256i bottom = HadamardSum_16x8_AVX2(block1 + 8 * stride, block2 + 8 * stride, stride);
+
+    alignas(32) int32_t out[2][8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out[0]), top);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out[1]), bottom);
+
+    long sum = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        sum += (out[i][0] + out[i][1] + out[i][2] + out[i][3] + 4) >> 3;
+        sum += (out[i][4] + out[i][5] + out[i][6] + out[i][7] + 4) >> 3;
+    }
+
+    return sum;
+}
+
+#endif
+
+// Runtime dispatch. The kernel table is filled once, when the module is loaded.
+
+using SADFunc = long (*)(const uint8_t*, const uint8_t*, int);
+using SADThresholdFunc = long (*)(const uint8_t*, const uint8_t*, int, long);
+using SADx8Func = void (*)(const uint8_t*, const uint8_t*, int, long*, long);
+using SADQuadrantsx8Func = void (*)(const uint8_t*, const uint8_t*, int, long (*)[8]);
+using SADBlocksFunc = void (*)(const uint8_t*, const uint8_t*, int, int, long*);
+
+struct MetricKernels
+{
+    SADFunc sad_16x16;
+    SADFunc sad_8x8;
+    SADThresholdFunc sad_16x16_threshold;
+    SADThresholdFunc sad_8x8_threshold;
+    SADx8Func sad_16x16_x8;
+    SADx8Func sad_8x8_x8;
+    SADQuadrantsx8Func sad_16x16_quadrants_x8;
+    SADBlocksFunc sad_16x16_blocks;
+    SADFunc satd_4x4;
+    SADFunc satd_8x8;
+    SADFunc satd_16x16;
+};
+
+static MetricKernels SelectKernels()
+{
+    MetricKernels kernels = {
+        GetErrorSAD_C<16, 16>,
+        GetErrorSAD_C<8, 8>,
+        GetErrorSAD_Threshold_C<16, 16>,
+        GetErrorSAD_Threshold_C<8, 8>,
+        GetErrorSAD_x8_C<16, 16>,
+        GetErrorSAD_x8_C<8, 8>,
+        GetErrorSAD_16x16_Quadrants_x8_C,
+        GetErrorSAD_16x16_Blocks_C,
+        GetErrorSATD_4x4_C,
+        GetErrorSATD_8x8_C,
+        GetErrorSATD_16x16_Quad<GetErrorSATD_8x8_C>
+    };
+
+#if defined(ME_X86)
+    const auto& cpu = GetCpuFeatures();
+
+    if (cpu.sse2)
+    {
+        kernels.sad_16x16 = GetErrorSAD_SSE2<16, 16>;
+        kernels.sad_8x8 = GetErrorSAD_SSE2<8, 8>;
+        kernels.sad_16x16_threshold = GetErrorSAD_16x16_Threshold_SSE2;
+        kernels.sad_8x8_threshold = GetErrorSAD_8x8_Threshold_SSE2;
+        kernels.sad_16x16_x8 = GetErrorSAD_16x16_x8_SSE2;
+        kernels.sad_8x8_x8 = GetErrorSAD_8x8_x8_SSE2;
+        kernels.sad_16x16_quadrants_x8 = GetErrorSAD_16x16_Quadrants_x8_SSE2;
+        kernels.sad_16x16_blocks = GetErrorSAD_16x16_Blocks_SSE2;
+        kernels.satd_4x4 = GetErrorSATD_4x4_SSE2;
+        kernels.satd_8x8 = GetErrorSATD_8x8_SSE2;
+        kernels.satd_16x16 = GetErrorSATD_16x16_Quad<GetErrorSATD_8x8_SSE2>;
+    }
+
+    if (cpu.sse41)
+    {
+        kernels.sad_16x16_x8 = GetErrorSAD_16x16_x8_SSE41;
+        kernels.sad_8x8_x8 = GetErrorSAD_8x8_x8_SSE41;
+        kernels.sad_16x16_quadrants_x8 = GetErrorSAD_16x16_Quadrants_x8_SSE41;
+    }
+
+    if (cpu.avx2)
+    {
+        kernels.sad_16x16 = GetErrorSAD_AVX2<16, 16>;
+        kernels.sad_8x8 = GetErrorSAD_AVX2<8, 8>;
+        kernels.sad_16x16_threshold = GetErrorSAD_16x16_Threshold_AVX2;
+        kernels.sad_16x16_x8 = GetErrorSAD_16x16_x8_AVX2;
+        kernels.sad_8x8_x8 = GetErrorSAD_8x8_x8_AVX2;
+        kernels.sad_16x16_blocks = GetErrorSAD_16x16_Blocks_AVX2;
+        kernels.satd_16x16 = GetErrorSATD_16x16_AVX2;
+    }
+#endif
+
+    return kernels;
+}
+
+static const MetricKernels kernels = SelectKernels();
+
+// Sad<W, H> dispatches separately for every shape.
+
+#if defined(ME_X86)
+template<int W, int H>
+static SADFunc SelectSAD_AVX2(std::true_type)
+{
+    return GetErrorSAD_AVX2<W, H>;
+}
+
+template<int W, int H>
+static SADFunc SelectSAD_AVX2(std::false_type)
+{
+    return GetErrorSAD_SSE2<W, H>;
+}
+#endif
+
+template<int W, int H>
+static SADFunc SelectSAD()
+{
+    SADFunc sad = GetErrorSAD_C<W, H>;
+
+#if defined(ME_X86)
+    const auto& cpu = GetCpuFeatures();
+
+    if (cpu.sse2)
+        sad = GetErrorSAD_SSE2<W, H>;
+
+    if (cpu.avx2)
+        sad = SelectSAD_AVX2<W, H>(std::integral_constant<bool, (W >= 8)>());
+#endif
+
+    return sad;
+}
+
+template<int W, int H>
+struct SADKernel
+{
+    static const SADFunc sad;
+};
+
+template<int W, int H>
+const SADFunc SADKernel<W, H>::sad = SelectSAD<W, H>();
+
+template<int W, int H>
+long Sad(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return SADKernel<W, H>::sad(block1, block2, stride);
+}
+
+template long Sad<4, 4>(const uint8_t*, const uint8_t*, int);
+template long Sad<8, 8>(const uint8_t*, const uint8_t*, int);
+template long Sad<16, 16>(const uint8_t*, const uint8_t*, int);
+template long Sad<32, 32>(const uint8_t*, const uint8_t*, int);
+template long Sad<64, 64>(const uint8_t*, const uint8_t*, int);
+template long Sad<8, 4>(const uint8_t*, const uint8_t*, int);
+template long Sad<4, 8>(const uint8_t*, const uint8_t*, int);
+template long Sad<16, 8>(const uint8_t*, const uint8_t*, int);
+template long Sad<8, 16>(const uint8_t*, const uint8_t*, int);
+template long Sad<32, 16>(const uint8_t*, const uint8_t*, int);
+template long Sad<16, 32>(const uint8_t*, const uint8_t*, int);
+template long Sad<64, 32>(const uint8_t*, const uint8_t*, int);
+template long Sad<32, 64>(const uint8_t*, const uint8_t*, int);
+
+long GetErrorSAD_16x16(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return kernels.sad_16x16(block1, block2, stride);
+}
+
+long GetErrorSAD_8x8(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return kernels.sad_8x8(block1, block2, stride);
+}
+
+long GetErrorSAD_16x16(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
+{
+    return kernels.sad_16x16_threshold(block1, block2, stride, threshold);
+}
+
+long GetErrorSAD_8x8(const uint8_t* block1, const uint8_t* block2, const int stride, const long threshold)
+{
+    return kernels.sad_8x8_threshold(block1, block2, stride, threshold);
+}
+
+void GetErrorSAD_16x16_x8(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    kernels.sad_16x16_x8(block1, block2, stride, errors, threshold);
+}
+
+void GetErrorSAD_8x8_x8(const uint8_t* block1, const uint8_t* block2, const int stride, long* errors, const long threshold)
+{
+    kernels.sad_8x8_x8(block1, block2, stride, errors, threshold);
+}
+
+void GetErrorSAD_16x16_Quadrants_x8(const uint8_t* block1, const uint8_t* block2, const int stride, long (*errors)[8])
+{
+    kernels.sad_16x16_quadrants_x8(block1, block2, stride, errors);
+}
+
+void GetErrorSAD_16x16_Blocks(const uint8_t* block1, const uint8_t* block2, const int stride, const int count, long* errors)
+{
+    kernels.sad_16x16_blocks(block1, block2, stride, count, errors);
+}
+
+long GetErrorSATD_4x4(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return kernels.satd_4x4(block1, block2, stride);
+}
+
+long GetErrorSATD_8x8(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return kernels.satd_8x8(block1, block2, stride);
+}
+
+long GetErrorSATD_16x16(const uint8_t* block1, const uint8_t* block2, const int stride)
+{
+    return kernels.satd_16x16(block1, block2, stride);
+}
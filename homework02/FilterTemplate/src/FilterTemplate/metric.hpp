@@ -2,8 +2,96 @@
 
 #include <cstdint>
 
+// The kernels below pick the fastest implementation supported by the CPU
+// (AVX2, SSE2 or plain C) once, when the module is loaded.
+
 /// Compute SAD between two 16x16 blocks
 long GetErrorSAD_16x16(const uint8_t* block1, const uint8_t* block2, int stride);
 
 /// Compute SAD between two 8x8 blocks
 long GetErrorSAD_8x8(const uint8_t* block1, const uint8_t* block2, int stride);
+
+/**
+ * Compute SAD between two W x H blocks
+ *
+ * Instantiated for the square blocks 4x4, 8x8, 16x16, 32x32, 64x64 and
+ * the 2:1 rectangles 8x4, 4x8, 16x8, 8x16, 32x16, 16x32, 64x32, 32x64.
+ * Each shape has its own unrolled SIMD kernel.
+ */
+template<int W, int H>
+long Sad(const uint8_t* block1, const uint8_t* block2, int stride);
+
+extern template long Sad<4, 4>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<8, 8>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<16, 16>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<32, 32>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<64, 64>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<8, 4>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<4, 8>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<16, 8>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<8, 16>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<32, 16>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<16, 32>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<64, 32>(const uint8_t*, const uint8_t*, int);
+extern template long Sad<32, 64>(const uint8_t*, const uint8_t*, int);
+
+/**
+ * Compute SAD between two 16x16 blocks, stopping early once it exceeds a threshold
+ *
+ * The partial sum is checked every four rows.
+ *
+ * @return the SAD if it is not greater than threshold, otherwise some value
+ *   greater than threshold and not greater than the SAD
+ */
+long GetErrorSAD_16x16(const uint8_t* block1, const uint8_t* block2, int stride, long threshold);
+
+/// Compute SAD between two 8x8 blocks, stopping early once it exceeds a threshold
+long GetErrorSAD_8x8(const uint8_t* block1, const uint8_t* block2, int stride, long threshold);
+
+/**
+ * Compute SADs between a 16x16 block and 8 reference blocks at consecutive x positions,
+ * stopping early once they exceed a threshold
+ *
+ * The partial sums are checked every four rows. Every SAD greater than threshold
+ * may be replaced by a partial sum, which is still greater than threshold.
+ *
+ * @param[in] block1 current block
+ * @param[in] block2 first reference block; errors[i] is the SAD against block2 + i
+ * @param[in] stride row stride of both blocks
+ * @param[out] errors array of 8 SADs
+ * @param[in] threshold largest SAD that must be exact
+ */
+void GetErrorSAD_16x16_x8(const uint8_t* block1, const uint8_t* block2, int stride, long* errors, long threshold);
+
+/// Compute SADs between an 8x8 block and 8 reference blocks at consecutive x positions,
+/// stopping early once they exceed a threshold
+void GetErrorSAD_8x8_x8(const uint8_t* block1, const uint8_t* block2, int stride, long* errors, long threshold);
+
+/**
+ * Compute SADs of the four 8x8 quadrants of a 16x16 block against 8 reference blocks
+ * at consecutive x positions, reading every reference row once
+ *
+ * @param[in] block1 current block
+ * @param[in] block2 first reference block
+ * @param[in] stride row stride of both blocks
+ * @param[out] errors errors[h][i] is the SAD of quadrant h, in raster order, against block2 + i
+ */
+void GetErrorSAD_16x16_Quadrants_x8(const uint8_t* block1, const uint8_t* block2, int stride, long (*errors)[8]);
+
+/// Compute SADs between count adjacent 16x16 blocks and the co-located reference blocks,
+/// reading each row of the blocks once
+void GetErrorSAD_16x16_Blocks(const uint8_t* block1, const uint8_t* block2, int stride, int count, long* errors);
+
+// SATD is the sum of absolute Hadamard-transformed differences. It follows the
+// cost of the coded residual much closer than SAD, at several times the price.
+// Values use the orthonormal transform scale, so for noise-like residuals
+// they are close to SAD of the same block.
+
+/// Compute SATD between two 4x4 blocks
+long GetErrorSATD_4x4(const uint8_t* block1, const uint8_t* block2, int stride);
+
+/// Compute SATD between two 8x8 blocks
+long GetErrorSATD_8x8(const uint8_t* block1, const uint8_t* block2, int stride);
+
+/// Compute SATD between two 16x16 blocks as the sum of four 8x8 SATDs
+long GetErrorSATD_16x16(const uint8_t* block1, const uint8_t* block2, int stride);
@@ -1,110 +1,898 @@
-#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #include "metric.hpp"
 #include "motion_estimator.hpp"
+#include "search.hpp"
+#include "subpel.hpp"
 
-MotionEstimator::MotionEstimator(int width, int height, uint8_t quality, bool use_half_pixel)
+namespace {
+
+/// Number of best SAD candidates re-ranked with SATD
+constexpr int SATD_CANDIDATES = MAX_CANDIDATES;
+
+/// Median of three values
+inline int Median(int a, int b, int c) {
+	return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+/// Vector component rounded to whole pixels, for seeding the whole-pixel search
+inline int ToPixels(int v) {
+	return (v + MV::ONE / 2) >> MV::FRACTION_BITS;
+}
+
+/// Vector scaled to the motion over one frame, from a reference further back
+inline MV ToOneFrame(const MV& v) {
+	return MV(v.x / (v.ref + 1), v.y / (v.ref + 1), v.error);
+}
+
+/// Smallest block of the partition
+constexpr int MIN_BLOCK_SIZE = 4;
+
+static_assert(MotionEstimator::BLOCK_SIZE == MotionField::BLOCK_SIZE && MIN_BLOCK_SIZE == MotionField::BLOCK_SIZE / 4,
+              "the motion field holds the partitions of the blocks down to the smallest size");
+
+/// Blocks with a cost up to this much per pixel are not split
+constexpr int SPLIT_THRESHOLD = 4;
+
+/// Bits of the flag that tells a split block from a whole one
+constexpr int SPLIT_FLAG_BITS = 1;
+
+/// SATD metric for a block size
+inline long (*GetSATD(int size))(const uint8_t*, const uint8_t*, int) {
+	switch (size) {
+	case 16:
+		return GetErrorSATD_16x16;
+	case 8:
+		return GetErrorSATD_8x8;
+	default:
+		return GetErrorSATD_4x4;
+	}
+}
+
+/// Size of the blocks searched on downsampled frames
+constexpr int COARSE_BLOCK_SIZE = 8;
+
+/// Search extent on the coarsest pyramid level, in pixels of that level
+constexpr int COARSE_RANGE = 16;
+
+/// Number of phase correlation tiles covering a frame dimension; the last
+/// tile is moved back to end at the frame edge
+inline int GetTileCount(int size) {
+	return (size >= PhaseCorrelation::TILE_SIZE) ? (size + PhaseCorrelation::TILE_SIZE - 1) / PhaseCorrelation::TILE_SIZE : 0;
+}
+
+/// Search range around short, consistent neighbour vectors, in pixels
+constexpr int MIN_RANGE = 2;
+
+/// Neighbours with a cost above this much per pixel are poorly predicted,
+/// and the block next to them gets the largest range
+constexpr int RANGE_ERROR_THRESHOLD = 8;
+
+/// Largest distance of a vector from the global motion model that the model
+/// still explains, in MV units
+constexpr double GLOBAL_TOLERANCE = MV::ONE;
+
+/**
+ * Describe a block at (row, col) of a plane with borders
+ *
+ * Only vectors that keep the reference block inside the plane are valid,
+ * so vectors may exceed the search range as long as the borders cover them.
+ *
+ * @param[in] cur current block
+ * @param[in] prev_plane reference plane with borders
+ * @param[in] stride row stride, equal to the width of the plane
+ * @param[in] plane_height height of the plane
+ * @param[in] size block size
+ * @param[in] row row of the block in the plane
+ * @param[in] col column of the block in the plane
+ * @param[in] range search range
+ * @param[in] seeds seeds of the pattern searches
+ */
+SearchBlock MakeSearchBlock(const uint8_t* cur,
+                            const uint8_t* prev_plane,
+                            int stride,
+                            int plane_height,
+                            int size,
+                            int row,
+                            int col,
+                            int range,
+                            const SeedList* seeds) {
+	SearchBlock block;
+
+	block.cur = cur;
+	block.prev = prev_plane + row * stride + col;
+	block.stride = stride;
+	block.size = size;
+	block.range = range;
+	block.min_x = -col;
+	block.max_x = stride - size - col;
+	block.min_y = -row;
+	block.max_y = plane_height - size - row;
+	block.seeds = seeds;
+	block.integral = nullptr;
+	block.cur_sums = nullptr;
+	block.row = row;
+	block.col = col;
+	block.pred_x = 0;
+	block.pred_y = 0;
+	block.lambda = 0;
+
+	return block;
+}
+
+/**
+ * Pick the final vector among the SAD candidates of a SIZE x SIZE block
+ *
+ * @param[in] candidates candidates sorted by cost
+ * @param[in] satd SATD metric for the block size, or nullptr to keep the cheapest SAD candidate
+ * @param[in] block searched block
+ * @param[in] planes reference planes by ShiftDir
+ */
+template<int SIZE>
+MV PickBest(const CandidateList& candidates,
+            long (*satd)(const uint8_t*, const uint8_t*, int),
+            const SearchBlock& block,
+            const uint8_t* const* planes) {
+	const auto* best = &candidates.items[0];
+	auto best_error = best->error;
+
+	if (satd) {
+		best_error = std::numeric_limits<long>::max();
+
+		for (int i = 0; i < candidates.count; ++i) {
+			const auto& candidate = candidates.items[i];
+			const auto error = GetSubpelError<SIZE>(satd,
+			                                        block.cur,
+			                                        planes,
+			                                        block.row * block.stride + block.col,
+			                                        block.stride,
+			                                        candidate.x,
+			                                        candidate.y)
+			                   + GetMVCost(block, candidate.x, candidate.y);
+
+			if (error < best_error) {
+				best = &candidate;
+				best_error = error;
+			}
+		}
+	}
+
+	return MV(best->x, best->y, best_error);
+}
+
+}
+
+MotionEstimator::MotionEstimator(int width,
+                                 int height,
+                                 uint8_t quality,
+                                 bool use_half_pixel,
+                                 int num_threads,
+                                 bool use_hash_matching,
+                                 int search_range)
 	: width(width)
 	, height(height)
 	, quality(quality)
 	, use_half_pixel(use_half_pixel)
-	, width_ext(width + 2 * BORDER)
+	, search_params(GetSearchParams(quality, std::min(std::max(search_range, 1), MAX_SEARCH_RANGE)))
+	, border(std::max(search_params.max_range, BLOCK_SIZE))
+	, width_ext(width + 2 * border)
+	, height_ext(height + 2 * border)
 	, num_blocks_hor((width + BLOCK_SIZE - 1) / BLOCK_SIZE)
 	, num_blocks_vert((height + BLOCK_SIZE - 1) / BLOCK_SIZE)
-	, first_row_offset(width_ext * BORDER + BORDER) {
-	// PUT YOUR CODE HERE
+	, first_row_offset(width_ext * border + border)
+	, search(CreateSearchStrategy(search_params))
+	, refine(CreateSearchStrategy({ SearchPattern::SMALL_DIAMOND, 2, 0, false, false, false, false, 0, 0, 0 }))
+	, track(CreateSearchStrategy({ SearchPattern::HEXAGON, 8, 1, false, false, false, false, 0, 0, 0 }))
+	, pool(std::make_unique<ThreadPool>(num_threads))
+	, row_progress(std::make_unique<std::atomic<int>[]>(num_blocks_vert))
+	, zero_sads(std::make_unique<long[]>(num_blocks_hor * num_blocks_vert))
+	, num_static_blocks(0)
+	, global_sad(0)
+	, num_global_blocks(0)
+	, num_hash_blocks(0)
+	, average_range(0.0) {
+	if (search_params.use_pyramid) {
+		cur_pyramid = std::make_unique<Pyramid>(width, height);
+		prev_pyramid = std::make_unique<Pyramid>(width, height);
+	}
+
+	if (search_params.use_phase_correlation)
+		phase_correlation = std::make_unique<PhaseCorrelation>();
+
+	if (use_hash_matching)
+		hash_matcher = std::make_unique<BlockHashMatcher>(width_ext, height_ext, num_blocks_hor, num_blocks_vert);
 }
 
 MotionEstimator::~MotionEstimator() {
 	// PUT YOUR CODE HERE
 }
 
-void MotionEstimator::Estimate(const uint8_t* cur_Y,
-                               const uint8_t* prev_Y,
-                               const uint8_t* prev_Y_up,
-                               const uint8_t* prev_Y_left,
-                               const uint8_t* prev_Y_upleft,
-                               MV* mvectors) {
-	std::unordered_map<ShiftDir, const uint8_t*> prev_map {
-		{ ShiftDir::NONE, prev_Y }
+void MotionEstimator::ForEachBlock(bool wavefront, const std::function<void(int, int)>& process) {
+	for (int i = 0; i < num_blocks_vert; ++i)
+		row_progress[i].store(0, std::memory_order_relaxed);
+
+	// Rows go to the threads in order. A row only waits for the rows above it,
+	// which are already taken, so the wait always ends.
+	pool->Run(num_blocks_vert, [&](int i) {
+		for (int j = 0; j < num_blocks_hor; ++j) {
+			if (wavefront && i > 0) {
+				const auto needed = std::min(j + 2, num_blocks_hor);
+
+				while (row_progress[i - 1].load(std::memory_order_acquire) < needed)
+					std::this_thread::yield();
+			}
+
+			process(i, j);
+			row_progress[i].store(j + 1, std::memory_order_release);
+		}
+	});
+}
+
+MV MotionEstimator::GetPredictor(const MotionField& mvectors, int i, int j) const {
+	const auto block_id = i * num_blocks_hor + j;
+	const auto left = (j > 0) ? mvectors.Get(block_id - 1) : MV();
+
+	if (i == 0)
+		return MV(left.x, left.y);
+
+	const auto top = mvectors.Get(block_id - num_blocks_hor);
+	const auto top_right = (j + 1 < num_blocks_hor) ? mvectors.Get(block_id - num_blocks_hor + 1) : MV();
+
+	return MV(Median(left.x, top.x, top_right.x), Median(left.y, top.y, top_right.y));
+}
+
+SeedList MotionEstimator::GetSeeds(const MotionField& mvectors, int i, int j) const {
+	SeedList seeds;
+	seeds.Add(0, 0);
+
+	if (global_motion.IsValid()) {
+		const auto global = GetGlobalVector(i, j);
+		seeds.Add(ToPixels(global.x), ToPixels(global.y));
+	}
+
+	// The seeds are for the previous frame, so vectors to older references are scaled to one frame.
+	const auto block_id = i * num_blocks_hor + j;
+	const auto left = (j > 0) ? ToOneFrame(mvectors.Get(block_id - 1)) : MV();
+	const auto top = (i > 0) ? ToOneFrame(mvectors.Get(block_id - num_blocks_hor)) : MV();
+	const auto top_right = (i > 0 && j + 1 < num_blocks_hor) ? ToOneFrame(mvectors.Get(block_id - num_blocks_hor + 1)) : MV();
+
+	// In the first row only the left neighbour is known, so it is the prediction.
+	if (i > 0)
+		seeds.Add(ToPixels(Median(left.x, top.x, top_right.x)), ToPixels(Median(left.y, top.y, top_right.y)));
+
+	if (j > 0)
+		seeds.Add(ToPixels(left.x), ToPixels(left.y));
+
+	if (i > 0) {
+		seeds.Add(ToPixels(top.x), ToPixels(top.y));
+		if (j + 1 < num_blocks_hor)
+			seeds.Add(ToPixels(top_right.x), ToPixels(top_right.y));
+	}
+
+	if (!prev_vectors.empty()) {
+		const auto colocated = ToOneFrame(prev_vectors[block_id]);
+		seeds.Add(ToPixels(colocated.x), ToPixels(colocated.y));
+	}
+
+	if (!coarse_vectors.empty())
+		seeds.Add(coarse_vectors[block_id].x, coarse_vectors[block_id].y);
+
+	if (!tile_vectors.empty()) {
+		const auto tiles_hor = GetTileCount(width);
+		const auto tile_row = std::min((i * BLOCK_SIZE + BLOCK_SIZE / 2) / PhaseCorrelation::TILE_SIZE, GetTileCount(height) - 1);
+		const auto tile_col = std::min((j * BLOCK_SIZE + BLOCK_SIZE / 2) / PhaseCorrelation::TILE_SIZE, tiles_hor - 1);
+		const auto& shifts = tile_vectors[tile_row * tiles_hor + tile_col];
+
+		for (int k = 0; k < shifts.count; ++k)
+			seeds.Add(shifts.items[k].x, shifts.items[k].y);
+	}
+
+	return seeds;
+}
+
+MV MotionEstimator::GetGlobalVector(int i, int j) const {
+	const auto row = border + i * BLOCK_SIZE;
+	const auto col = border + j * BLOCK_SIZE;
+	const auto x = j * BLOCK_SIZE + BLOCK_SIZE / 2 - width / 2.0;
+	const auto y = i * BLOCK_SIZE + BLOCK_SIZE / 2 - height / 2.0;
+
+	const auto step = !use_half_pixel ? MV::ONE : search_params.use_quarter_pixel ? MV::ONE / 4 : MV::ONE / 2;
+	const auto quantize = [&](double v, int min, int max) {
+		return std::min(std::max(static_cast<int>(std::lround(v / step)) * step, min * MV::ONE), max * MV::ONE);
 	};
 
-	if (use_half_pixel) {
-		prev_map.emplace(ShiftDir::UP, prev_Y_up);
-		prev_map.emplace(ShiftDir::LEFT, prev_Y_left);
-		prev_map.emplace(ShiftDir::UPLEFT, prev_Y_upleft);
+	return MV(quantize(global_motion.X(x, y), -col, width_ext - BLOCK_SIZE - col),
+	          quantize(global_motion.Y(x, y), -row, height_ext - BLOCK_SIZE - row));
+}
+
+int MotionEstimator::GetSearchRange(const MotionField& mvectors, int i, int j) const {
+	const auto block_id = i * num_blocks_hor + j;
+
+	MV neighbours[4];
+	int count = 0;
+
+	if (j > 0)
+		neighbours[count++] = ToOneFrame(mvectors.Get(block_id - 1));
+
+	if (i > 0) {
+		neighbours[count++] = ToOneFrame(mvectors.Get(block_id - num_blocks_hor));
+		if (j + 1 < num_blocks_hor)
+			neighbours[count++] = ToOneFrame(mvectors.Get(block_id - num_blocks_hor + 1));
+	}
+
+	if (!prev_vectors.empty())
+		neighbours[count++] = ToOneFrame(prev_vectors[block_id]);
+
+	// A single neighbour says nothing about how uniform the motion is.
+	if (count < 2)
+		return search_params.max_range;
+
+	auto min_x = std::numeric_limits<int>::max();
+	auto max_x = std::numeric_limits<int>::min();
+	auto min_y = std::numeric_limits<int>::max();
+	auto max_y = std::numeric_limits<int>::min();
+
+	for (int k = 0; k < count; ++k) {
+		const auto& neighbour = neighbours[k];
+
+		if (neighbour.error > RANGE_ERROR_THRESHOLD * BLOCK_SIZE * BLOCK_SIZE)
+			return search_params.max_range;
+
+		min_x = std::min(min_x, neighbour.x);
+		max_x = std::max(max_x, neighbour.x);
+		min_y = std::min(min_y, neighbour.y);
+		max_y = std::max(max_y, neighbour.y);
+	}
+
+	auto reach = std::max(std::max(-min_x, max_x), std::max(-min_y, max_y));
+	if (global_motion.IsValid()) {
+		const auto global = GetGlobalVector(i, j);
+		reach = std::max(reach, std::max(std::abs(global.x), std::abs(global.y)));
 	}
 
+	// The vectors are in MV units; the range in whole pixels covers them.
+	const auto spread = std::max(max_x - min_x, max_y - min_y);
+	const auto range = (reach + spread + MV::ONE - 1) / MV::ONE + MIN_RANGE;
+
+	return std::min(range, search_params.max_range);
+}
+
+bool MotionEstimator::FindExactMatch(const uint8_t* cur_Y,
+                                     const uint8_t* prev_Y,
+                                     int i,
+                                     int j,
+                                     int pred_x,
+                                     int pred_y,
+                                     MV& vector) const {
+	const auto row = border + i * BLOCK_SIZE;
+	const auto col = border + j * BLOCK_SIZE;
+	const auto cur = cur_Y + row * width_ext + col;
+
+	// The copy the block moved with is likely near where the prediction points.
+	BlockHashMatcher::Position matches[BlockHashMatcher::MAX_MATCHES];
+	const auto count = hash_matcher->GetMatches(i * num_blocks_hor + j,
+	                                            row + ToPixels(pred_y),
+	                                            col + ToPixels(pred_x),
+	                                            matches);
+
+	auto best_bits = std::numeric_limits<int>::max();
+
+	for (int k = 0; k < count; ++k) {
+		const auto match = prev_Y + matches[k].row * width_ext + matches[k].col;
+
+		auto equal = true;
+		for (int y = 0; y < BLOCK_SIZE && equal; ++y)
+			equal = memcmp(cur + y * width_ext, match + y * width_ext, BLOCK_SIZE) == 0;
+
+		if (!equal)
+			continue;
+
+		const auto x = (matches[k].col - col) * MV::ONE;
+		const auto y = (matches[k].row - row) * MV::ONE;
+		const auto bits = GetMVBits(x - pred_x, y - pred_y);
+
+		if (bits < best_bits) {
+			best_bits = bits;
+			vector = MV(x, y, 0);
+		}
+	}
+
+	return best_bits != std::numeric_limits<int>::max();
+}
+
+void MotionEstimator::FitGlobalMotion(const uint8_t* cur_Y, const ReferencePlanes& prev_planes, const MotionField& mvectors) {
+	std::vector<GlobalMotion::Sample> samples(num_blocks_hor * num_blocks_vert);
+
+	// Vectors to older references are scaled to one frame.
 	for (int i = 0; i < num_blocks_vert; ++i) {
 		for (int j = 0; j < num_blocks_hor; ++j) {
+			const auto vector = mvectors.Get(i * num_blocks_hor + j);
+			auto& sample = samples[i * num_blocks_hor + j];
+
+			sample.x = j * BLOCK_SIZE + BLOCK_SIZE / 2 - width / 2.0;
+			sample.y = i * BLOCK_SIZE + BLOCK_SIZE / 2 - height / 2.0;
+			sample.vx = static_cast<double>(vector.x) / (vector.ref + 1);
+			sample.vy = static_cast<double>(vector.y) / (vector.ref + 1);
+		}
+	}
+
+	global_motion.Fit(samples.data(), static_cast<int>(samples.size()), GLOBAL_TOLERANCE);
+
+	// Sub-pixel camera motion leaves an interpolation residual in every block,
+	// so the SADs of the blocks that follow the model tell what it can achieve.
+	std::vector<long> errors;
+
+	for (int k = 0; k < num_blocks_hor * num_blocks_vert; ++k) {
+		const auto& sample = samples[k];
+		const auto vector = mvectors.Get(k);
+		const auto distance = std::hypot(sample.vx - global_motion.X(sample.x, sample.y),
+		                                 sample.vy - global_motion.Y(sample.x, sample.y));
+
+		if (vector.ref == 0 && distance <= GLOBAL_TOLERANCE) {
+			const auto offset = (border + k / num_blocks_hor * BLOCK_SIZE) * width_ext + border + k % num_blocks_hor * BLOCK_SIZE;
+			errors.push_back(GetSubpelError<BLOCK_SIZE>(Sad<BLOCK_SIZE, BLOCK_SIZE>,
+			                                            cur_Y + offset,
+			                                            prev_planes.data(),
+			                                            offset,
+			                                            width_ext,
+			                                            vector.x,
+			                                            vector.y));
+		}
+	}
+
+	global_sad = search_params.static_sad;
+
+	if (!errors.empty()) {
+		const auto middle = errors.begin() + errors.size() / 2;
+		std::nth_element(errors.begin(), middle, errors.end());
+		global_sad = std::max(global_sad, *middle);
+	}
+}
+
+void MotionEstimator::EstimateCoarse(const uint8_t* cur_Y, const uint8_t* prev_Y) {
+	// The previous frame is the current frame of the last call, unless the
+	// estimator was reset since.
+	if (!prev_pyramid->IsBuilt())
+		prev_pyramid->Build(prev_Y, border);
+
+	cur_pyramid->Build(cur_Y, border);
+
+	coarse_vectors.resize(num_blocks_hor * num_blocks_vert);
+
+	// The coarsest level is searched with the main strategy, the finer ones
+	// only refine the doubled vectors of the level above.
+	for (int level = Pyramid::LEVELS - 1; level >= 1; --level) {
+		const auto top = (level == Pyramid::LEVELS - 1);
+		const auto stride = cur_pyramid->WidthExt(level);
+		const auto plane_height = cur_pyramid->HeightExt(level);
+		const auto cur_plane = cur_pyramid->Level(level);
+		const auto prev_plane = prev_pyramid->Level(level);
+
+		// The coarse block is centered on the area of the full-size block.
+		const auto margin = (COARSE_BLOCK_SIZE - (BLOCK_SIZE >> level)) / 2;
+
+		// Only the coarsest level seeds from the neighbours.
+		ForEachBlock(top, [&](int i, int j) {
 			const auto block_id = i * num_blocks_hor + j;
-			const auto hor_offset = j * BLOCK_SIZE;
-			const auto vert_offset = first_row_offset + i * BLOCK_SIZE * width_ext;
-			const auto cur = cur_Y + vert_offset + hor_offset;
-
-			MV best_vector;
-			best_vector.error = std::numeric_limits<long>::max();
-
-			// PUT YOUR CODE HERE
-			
-			// Brute force
-			for (const auto& prev_pair : prev_map) {
-				const auto prev = prev_pair.second + vert_offset + hor_offset;
-
-				for (int y = -BORDER; y <= BORDER; ++y) {
-					for (int x = -BORDER; x <= BORDER; ++x) {
-						const auto comp = prev + y * width_ext + x;
-						const auto error = GetErrorSAD_16x16(cur, comp, width_ext);
-
-						if (error < best_vector.error) {
-							best_vector.x = x;
-							best_vector.y = y;
-							best_vector.shift_dir = prev_pair.first;
-							best_vector.error = error;
-						}
-					}
+			const auto row = Pyramid::BORDER + ((i * BLOCK_SIZE) >> level) - margin;
+			const auto col = Pyramid::BORDER + ((j * BLOCK_SIZE) >> level) - margin;
+
+			SeedList seeds;
+
+			if (top) {
+				seeds.Add(0, 0);
+
+				if (j > 0)
+					seeds.Add(coarse_vectors[block_id - 1].x, coarse_vectors[block_id - 1].y);
+
+				if (i > 0)
+					seeds.Add(coarse_vectors[block_id - num_blocks_hor].x, coarse_vectors[block_id - num_blocks_hor].y);
+
+				if (!prev_vectors.empty()) {
+					const auto colocated = ToOneFrame(prev_vectors[block_id]);
+					seeds.Add(colocated.x >> (level + MV::FRACTION_BITS), colocated.y >> (level + MV::FRACTION_BITS));
 				}
+			} else {
+				seeds.Add(2 * coarse_vectors[block_id].x, 2 * coarse_vectors[block_id].y);
+			}
+
+			const auto block = MakeSearchBlock(cur_plane + row * stride + col,
+			                                   prev_plane,
+			                                   stride,
+			                                   plane_height,
+			                                   COARSE_BLOCK_SIZE,
+			                                   row,
+			                                   col,
+			                                   COARSE_RANGE,
+			                                   &seeds);
+
+			CandidateList candidates(1);
+			(top ? search : refine)->Search(block, candidates);
+
+			coarse_vectors[block_id] = { candidates.items[0].x / MV::ONE, candidates.items[0].y / MV::ONE };
+		});
+	}
+
+	// Full-size vectors
+	for (auto& vector : coarse_vectors) {
+		vector.x *= 2;
+		vector.y *= 2;
+	}
+
+	std::swap(cur_pyramid, prev_pyramid);
+}
+
+void MotionEstimator::CorrelateTiles(const uint8_t* cur_Y, const uint8_t* prev_Y) {
+	const auto tiles_hor = GetTileCount(width);
+	const auto tiles_vert = GetTileCount(height);
+
+	tile_vectors.assign(tiles_hor * tiles_vert, SeedList());
+
+	pool->Run(tiles_hor * tiles_vert, [&](int tile) {
+		const auto x = std::min((tile % tiles_hor) * PhaseCorrelation::TILE_SIZE, width - PhaseCorrelation::TILE_SIZE);
+		const auto y = std::min((tile / tiles_hor) * PhaseCorrelation::TILE_SIZE, height - PhaseCorrelation::TILE_SIZE);
+		const auto offset = first_row_offset + y * width_ext + x;
+
+		PhaseCorrelation::Peak peaks[PhaseCorrelation::MAX_PEAKS];
+		const auto count = phase_correlation->FindPeaks(cur_Y + offset, prev_Y + offset, width_ext, peaks);
+
+		for (int k = 0; k < count; ++k)
+			tile_vectors[tile].Add(peaks[k].x, peaks[k].y);
+	});
+}
+
+void MotionEstimator::RefineSubpixel(const SearchBlock& block,
+                                     const uint8_t* const* planes,
+                                     CandidateList& candidates) const {
+	if (!use_half_pixel)
+		return;
+
+	::RefineSubpixel(block, planes, MV::ONE / 2, candidates);
+
+	if (search_params.use_quarter_pixel)
+		::RefineSubpixel(block, planes, MV::ONE / 4, candidates);
+}
+
+template<int SIZE>
+MV MotionEstimator::EstimateBlock(const uint8_t* cur_Y,
+                                  const Pass& pass,
+                                  int row,
+                                  int col,
+                                  int range,
+                                  const SeedList& seeds,
+                                  int pred_x,
+                                  int pred_y,
+                                  MotionField& mvectors,
+                                  int node,
+                                  bool joint,
+                                  const CandidateList* searched) const {
+	const auto cur = cur_Y + row * width_ext + col;
+	const auto num_candidates = search_params.use_satd ? SATD_CANDIDATES : 1;
+
+	// The exhaustive search finds the whole-pixel candidates of the quarters
+	// together with those of the block. Without the bounds of the quarters it
+	// prunes fewer positions, so it is only worth it where splits are likely.
+	joint = joint && !searched && pass.integrals && SIZE > MIN_BLOCK_SIZE;
+	CandidateList quarters[4] = {
+		CandidateList(num_candidates),
+		CandidateList(num_candidates),
+		CandidateList(num_candidates),
+		CandidateList(num_candidates)
+	};
+
+	long cur_sums[4];
+	if (pass.integrals)
+		GetQuadrantSums(cur, width_ext, SIZE, cur_sums);
+
+	MV vector;
+
+	for (int ref = 0; ref < pass.num_refs; ++ref) {
+		const auto planes = pass.refs[ref].data();
+
+		// Motion over more frames is proportionally longer.
+		SeedList ref_seeds;
+		for (int i = 0; i < seeds.count; ++i)
+			ref_seeds.Add((ref + 1) * seeds.items[i].x, (ref + 1) * seeds.items[i].y);
+
+		if (ref > 0) {
+			ref_seeds.Add(ToPixels((ref + 1) * vector.x / (vector.ref + 1)),
+			              ToPixels((ref + 1) * vector.y / (vector.ref + 1)));
+		}
+
+		CandidateList candidates(num_candidates);
+		auto block = MakeSearchBlock(cur,
+		                             planes[0],
+		                             width_ext,
+		                             height_ext,
+		                             SIZE,
+		                             row,
+		                             col,
+		                             std::min(range * (ref + 1), search_params.max_range),
+		                             &ref_seeds);
+
+		block.pred_x = pred_x;
+		block.pred_y = pred_y;
+		block.lambda = search_params.lambda;
+
+		if (pass.integrals) {
+			block.integral = pass.integrals[ref].get();
+			block.cur_sums = cur_sums;
+		}
+
+		// Whole-pixel search, then the sub-pixel positions around its best vector
+		if (ref == 0 && searched) {
+			for (int i = 0; i < searched->count; ++i) {
+				const auto& candidate = searched->items[i];
+				candidates.Add(candidate.x, candidate.y, candidate.error + GetMVCost(block, candidate.x, candidate.y));
 			}
 
-			// Split into four subvectors if the error is too large
-			if (best_vector.error > 1000) {
-				best_vector.Split();
-
-				for (int h = 0; h < 4; ++h) {
-					auto& subvector = best_vector.SubVector(h);
-					subvector.error = std::numeric_limits<long>::max();
-
-					const auto hor_offset = j * BLOCK_SIZE + ((h & 1) ? BLOCK_SIZE / 2 : 0);
-					const auto vert_offset = first_row_offset + (i * BLOCK_SIZE + ((h > 1) ? BLOCK_SIZE / 2 : 0)) * width_ext;
-					const auto cur = cur_Y + vert_offset + hor_offset;
-
-					for (const auto& prev_pair : prev_map) {
-						const auto prev = prev_pair.second + vert_offset + hor_offset;
-
-						for (int y = -BORDER; y <= BORDER; ++y) {
-							for (int x = -BORDER; x <= BORDER; ++x) {
-								const auto comp = prev + y * width_ext + x;
-								const auto error = GetErrorSAD_8x8(cur, comp, width_ext);
-
-								if (error < subvector.error) {
-									subvector.x = x;
-									subvector.y = y;
-									subvector.shift_dir = prev_pair.first;
-									subvector.error = error;
-								}
-							}
-						}
-					}
+			// The joint search ranked the candidates by SAD before this predictor was
+			// known, so the seeds, cheap to code from it, are scored as well.
+			SearchSeeds(block, candidates);
+		} else {
+			if (ref == 0 && joint)
+				SearchJoint(block, candidates, quarters);
+			else
+				pass.search->Search(block, candidates);
+
+			// The exhaustive search ignores seeds, so the ones past its range,
+			// such as long tile shifts, get a pattern search of their own.
+			if (pass.integrals) {
+				SeedList far_seeds;
+
+				for (int i = 0; i < ref_seeds.count; ++i) {
+					const auto& seed = ref_seeds.items[i];
+					if (std::abs(seed.x) > block.range || std::abs(seed.y) > block.range)
+						far_seeds.Add(seed.x, seed.y);
 				}
 
-				if (best_vector.SubVector(0).error
-				    + best_vector.SubVector(1).error
-				    + best_vector.SubVector(2).error
-				    + best_vector.SubVector(3).error > best_vector.error * 0.7)
-					best_vector.Unsplit();
+				if (far_seeds.count > 0) {
+					auto far_block = block;
+					far_block.seeds = &far_seeds;
+					track->Search(far_block, candidates);
+				}
 			}
+		}
+
+		RefineSubpixel(block, planes, candidates);
+
+		// SAD finds the candidates, SATD picks the one with the cheapest residual.
+		auto best = PickBest<SIZE>(candidates, search_params.use_satd ? GetSATD(SIZE) : nullptr, block, planes);
+		best.error += search_params.lambda * GetRefBits(ref, pass.num_refs);
+		best.ref = ref;
+
+		if (best.error < vector.error)
+			vector = std::move(best);
+	}
+
+	// Blocks that are already predicted well keep one vector.
+	if (SIZE == MIN_BLOCK_SIZE || vector.error <= SPLIT_THRESHOLD * SIZE * SIZE) {
+		mvectors.Set(node, vector);
+		return vector;
+	}
+
+	// The vector of the whole block is the natural start for its quarters,
+	// and their vectors are coded relative to it.
+	SeedList subseeds;
+	subseeds.Add(0, 0);
+	subseeds.Add(ToPixels(ToOneFrame(vector).x), ToPixels(ToOneFrame(vector).y));
+
+	MV split(vector.x, vector.y, search_params.lambda * SPLIT_FLAG_BITS, vector.ref);
+
+	// The smallest size never gets here, but the recursion has to end at
+	// compile time too.
+	constexpr auto half = (SIZE > MIN_BLOCK_SIZE) ? SIZE / 2 : MIN_BLOCK_SIZE;
+
+	// The quarters search the largest range: where the block has to be split,
+	// the neighbours no longer tell how its parts move.
+	for (int h = 0; h < 4; ++h) {
+		split.error += EstimateBlock<half>(cur_Y,
+		                                   pass,
+		                                   row + ((h > 1) ? half : 0),
+		                                   col + ((h & 1) ? half : 0),
+		                                   search_params.max_range,
+		                                   subseeds,
+		                                   vector.x,
+		                                   vector.y,
+		                                   mvectors,
+		                                   mvectors.Child(node, h),
+		                                   false,
+		                                   joint ? &quarters[h] : nullptr).error;
+
+		// Stop as soon as the quarters cost more than the whole block.
+		if (split.error >= vector.error) {
+			mvectors.Set(node, vector);
+			return vector;
+		}
+	}
 
-			mvectors[block_id] = best_vector;
+	// The quarters hold their vectors already.
+	mvectors.Set(node, split);
+	mvectors.Split(node);
+	return split;
+}
+
+void MotionEstimator::Estimate(const uint8_t* cur_Y,
+                               const uint8_t* prev_Y,
+                               const uint8_t* prev_Y_up,
+                               const uint8_t* prev_Y_left,
+                               const uint8_t* prev_Y_upleft,
+                               MotionField& mvectors) {
+	const ReferencePlanes refs[] = { { { prev_Y, prev_Y_up, prev_Y_left, prev_Y_upleft } } };
+
+	Estimate(cur_Y, refs, 1, mvectors);
+}
+
+void MotionEstimator::Estimate(const uint8_t* cur_Y, const ReferencePlanes* refs, int num_refs, MotionField& mvectors) {
+	const auto prev_Y = refs[0][static_cast<int>(ShiftDir::NONE)];
+	const auto exhaustive = search_params.pattern == SearchPattern::EXHAUSTIVE;
+	const Pass pass = { refs, num_refs, search.get(), exhaustive ? integrals : nullptr };
+
+	// Zero-vector SADs of all blocks in one sweep over the frames, a block row per job
+	pool->Run(num_blocks_vert, [&](int i) {
+		const auto offset = (border + i * BLOCK_SIZE) * width_ext + border;
+		GetErrorSAD_16x16_Blocks(cur_Y + offset, prev_Y + offset, width_ext, num_blocks_hor, &zero_sads[i * num_blocks_hor]);
+	});
+
+	// Block sums of the reference planes for pruning the exhaustive search.
+	if (exhaustive) {
+		for (int ref = 0; ref < num_refs; ++ref) {
+			if (!integrals[ref])
+				integrals[ref] = std::make_unique<IntegralImage>(width_ext, height_ext);
+
+			integrals[ref]->Build(refs[ref][static_cast<int>(ShiftDir::NONE)], width_ext);
 		}
 	}
+
+	// Coarse vectors for seeding the full-size search
+	if (search_params.use_pyramid)
+		EstimateCoarse(cur_Y, prev_Y);
+
+	// Long shifts for seeding it past its range
+	if (search_params.use_phase_correlation)
+		CorrelateTiles(cur_Y, prev_Y);
+
+	// Positions of the previous frame that may hold copies of the blocks
+	if (hash_matcher)
+		hash_matcher->Find(cur_Y, prev_Y, border, border);
+
+	std::atomic<int> global_blocks(0);
+	std::atomic<int> hash_blocks(0);
+	std::atomic<int> searched_blocks(0);
+	std::atomic<long> range_sum(0);
+
+	// The predicted vector and the seeds come from the left, top and top-right
+	// neighbours, so the blocks go in the wavefront order.
+	ForEachBlock(true, [&](int i, int j) {
+		const auto row = border + i * BLOCK_SIZE;
+		const auto col = border + j * BLOCK_SIZE;
+		const auto block_id = i * num_blocks_hor + j;
+
+		// PUT YOUR CODE HERE
+
+		// Static blocks take the zero vector without a search.
+		if (zero_sads[block_id] <= search_params.static_sad) {
+			mvectors.Set(block_id, MV(0, 0, zero_sads[block_id]));
+			return;
+		}
+
+		const auto pred = GetPredictor(mvectors, i, j);
+
+		// Exact copies of the block are taken wherever they are, such as in
+		// scrolled screen content.
+		MV copy;
+		if (hash_matcher && FindExactMatch(cur_Y, prev_Y, i, j, pred.x, pred.y, copy)) {
+			mvectors.Set(block_id, copy);
+			hash_blocks.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		// Blocks that move with the camera take the global motion vector without a search.
+		if (global_motion.IsValid()) {
+			const auto global = GetGlobalVector(i, j);
+
+			if (global.x != 0 || global.y != 0) {
+				const auto error = GetSubpelError<BLOCK_SIZE>(Sad<BLOCK_SIZE, BLOCK_SIZE>,
+				                                              cur_Y + row * width_ext + col,
+				                                              refs[0].data(),
+				                                              row * width_ext + col,
+				                                              width_ext,
+				                                              global.x,
+				                                              global.y);
+
+				if (error <= global_sad) {
+					mvectors.Set(block_id, MV(global.x, global.y, error));
+					global_blocks.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+			}
+		}
+
+		const auto seeds = GetSeeds(mvectors, i, j);
+
+		// Split left and top neighbours suggest detailed motion here as well.
+		const auto joint = i > 0 && j > 0
+		                   && mvectors.IsSplit(block_id - 1)
+		                   && mvectors.IsSplit(block_id - num_blocks_hor);
+
+		// The joint search also finds the candidates of the quarters, so it keeps the largest range.
+		const auto range = joint ? search_params.max_range : GetSearchRange(mvectors, i, j);
+
+		searched_blocks.fetch_add(1, std::memory_order_relaxed);
+		range_sum.fetch_add(range, std::memory_order_relaxed);
+
+		EstimateBlock<BLOCK_SIZE>(cur_Y, pass, row, col, range, seeds, pred.x, pred.y, mvectors, block_id, joint);
+	});
+
+	num_static_blocks = static_cast<int>(std::count_if(zero_sads.get(),
+	                                                   zero_sads.get() + num_blocks_hor * num_blocks_vert,
+	                                                   [&](long sad) { return sad <= search_params.static_sad; }));
+
+	num_global_blocks = global_blocks.load();
+	num_hash_blocks = hash_blocks.load();
+	average_range = (searched_blocks.load() > 0) ? static_cast<double>(range_sum.load()) / searched_blocks.load() : 0.0;
+
+	// Camera motion continues into the next frame, where it seeds every block.
+	FitGlobalMotion(cur_Y, refs[0], mvectors);
+
+	// Keep the field for the co-located seeds of the next frame
+	prev_vectors.resize(num_blocks_hor * num_blocks_vert);
+
+	for (int i = 0; i < num_blocks_hor * num_blocks_vert; ++i)
+		prev_vectors[i] = mvectors.Get(i);
+}
+
+double MotionEstimator::GetStaticRatio() const {
+	return static_cast<double>(num_static_blocks) / (num_blocks_hor * num_blocks_vert);
+}
+
+double MotionEstimator::GetGlobalRatio() const {
+	return static_cast<double>(num_global_blocks) / (num_blocks_hor * num_blocks_vert);
+}
+
+double MotionEstimator::GetHashRatio() const {
+	return static_cast<double>(num_hash_blocks) / (num_blocks_hor * num_blocks_vert);
+}
+
+double MotionEstimator::GetAverageRange() const {
+	return average_range;
+}
+
+void MotionEstimator::Reset() {
+	if (prev_pyramid)
+		prev_pyramid->Invalidate();
+
+	prev_vectors.clear();
+	global_motion.Reset();
+}
+
+void MotionEstimator::EstimateForward(const uint8_t* cur_Y, const ReferencePlanes& next, const MotionField& backward, MotionField& mvectors) {
+	const Pass pass = { &next, 1, track.get(), nullptr };
+
+	ForEachBlock(true, [&](int i, int j) {
+		const auto row = border + i * BLOCK_SIZE;
+		const auto col = border + j * BLOCK_SIZE;
+		const auto block_id = i * num_blocks_hor + j;
+
+		// The backward vector reversed and scaled to one frame, then the forward neighbours
+		const auto back = ToOneFrame(backward.Get(block_id));
+
+		SeedList seeds;
+		seeds.Add(0, 0);
+		seeds.Add(ToPixels(-back.x), ToPixels(-back.y));
+
+		if (j > 0)
+			seeds.Add(ToPixels(mvectors.Get(block_id - 1).x), ToPixels(mvectors.Get(block_id - 1).y));
+
+		if (i > 0)
+			seeds.Add(ToPixels(mvectors.Get(block_id - num_blocks_hor).x), ToPixels(mvectors.Get(block_id - num_blocks_hor).y));
+
+		const auto pred = GetPredictor(mvectors, i, j);
+
+		EstimateBlock<BLOCK_SIZE>(cur_Y, pass, row, col, search_params.max_range, seeds, pred.x, pred.y, mvectors, block_id);
+	});
 }
@@ -1,15 +1,60 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "block_hash.hpp"
+#include "global_motion.hpp"
+#include "integral_image.hpp"
+#include "motion_field.hpp"
 #include "mv.hpp"
+#include "phase_correlation.hpp"
+#include "pyramid.hpp"
+#include "search.hpp"
+#include "thread_pool.hpp"
 
 constexpr const char FILTER_NAME[] = "ME_your_surname";
 constexpr const char FILTER_AUTHOR[] = "PUT YOUR NAME HERE";
 
 class MotionEstimator {
 public:
-	/// Constructor
-	MotionEstimator(int width, int height, uint8_t quality, bool use_half_pixel);
+	/// Planes of a reference frame by ShiftDir. The shifted planes are
+	/// only valid if use_half_pixel is true.
+	using ReferencePlanes = std::array<const uint8_t*, 4>;
+
+	/// Most reference frames a block can be predicted from
+	static constexpr int MAX_REFERENCES = 4;
+
+	/// Search range used unless another one is given, in pixels
+	static constexpr int DEFAULT_SEARCH_RANGE = 16;
+
+	/// Largest search range, in pixels
+	static constexpr int MAX_SEARCH_RANGE = 128;
+
+	/**
+	 * Constructor
+	 *
+	 * @param[in] width frame width
+	 * @param[in] height frame height
+	 * @param[in] quality quality in 0..100
+	 * @param[in] use_half_pixel whether to use half-pixel precision
+	 * @param[in] num_threads number of threads searching the blocks,
+	 *   0 for one per hardware thread. The vectors do not depend on it.
+	 * @param[in] use_hash_matching whether to look for exact copies of every block
+	 *   anywhere in the previous frame by hash before searching for it
+	 * @param[in] search_range largest vector component the search looks at, in pixels,
+	 *   clamped to 1..MAX_SEARCH_RANGE. The frames need borders of GetBorder() pixels.
+	 */
+	MotionEstimator(int width,
+	                int height,
+	                uint8_t quality,
+	                bool use_half_pixel,
+	                int num_threads = 0,
+	                bool use_hash_matching = false,
+	                int search_range = DEFAULT_SEARCH_RANGE);
 
 	/// Destructor
 	~MotionEstimator();
@@ -37,25 +82,253 @@ public:
 	 *   only valid if use_half_pixel is true
 	 * @param[in] prev_Y_upleft array of pixels of the previous frame shifted half a pixel up left,
 	 *   only valid if use_half_pixel is true
-	 * @param[out] mvectors output array of motion vectors
+	 * @param[out] mvectors output motion vectors with the partitions of the blocks
+	 *
+	 * The downsampled current frame, its vectors and the camera motion fitted
+	 * to them are kept for the next call, so prev_Y has to be this cur_Y
+	 * then, unless Reset is called in between.
 	 */
 	void Estimate(const uint8_t* cur_Y,
 	              const uint8_t* prev_Y,
 	              const uint8_t* prev_Y_up,
 	              const uint8_t* prev_Y_left,
 	              const uint8_t* prev_Y_upleft,
-	              MV* mvectors);
+	              MotionField& mvectors);
+
+	/**
+	 * Estimate motion against several reference frames
+	 *
+	 * Every block and every part of a split block gets the reference that
+	 * predicts it at the lowest cost, which counts the bits of the reference index.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] refs planes of the reference frames, the previous frame first
+	 * @param[in] num_refs number of reference frames, 1..MAX_REFERENCES
+	 * @param[out] mvectors output motion vectors with the partitions of the blocks
+	 */
+	void Estimate(const uint8_t* cur_Y, const ReferencePlanes* refs, int num_refs, MotionField& mvectors);
 
 	/**
-	 * Size of the borders added to frames by the template, in pixels.
+	 * Estimate motion from the current frame to the next one
+	 *
+	 * At constant velocity a block moves by its backward vector reversed,
+	 * so the backward field seeds a cheap pattern search instead of a second
+	 * full search.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] next planes of the next frame
+	 * @param[in] backward vectors of the current frame found by Estimate
+	 * @param[out] mvectors output motion vectors pointing into the next frame
+	 */
+	void EstimateForward(const uint8_t* cur_Y, const ReferencePlanes& next, const MotionField& backward, MotionField& mvectors);
+
+	/// Share of the blocks of the last frame that took the zero vector without a search
+	double GetStaticRatio() const;
+
+	/// Share of the blocks of the last frame that took the global motion vector without a search
+	double GetGlobalRatio() const;
+
+	/// Share of the blocks of the last frame that took an exact copy found by hash without a search
+	double GetHashRatio() const;
+
+	/// Average search range of the blocks of the last frame that were searched, in pixels
+	double GetAverageRange() const;
+
+	/// Forget the frames seen so far, for when the next previous frame is not
+	/// the last current one, such as after a seek
+	void Reset();
+
+	/**
+	 * Size of the borders the frames need, in pixels: the search range, but
+	 * at least a block, which covers the blocks that extend past the image.
 	 * This is the most pixels your motion vectors can extend past the image border.
 	 */
-	static constexpr int BORDER = 16;
+	inline int GetBorder() const {
+		return border;
+	}
 
 	/// Size of a block covered by a motion vector. Do not change.
 	static constexpr int BLOCK_SIZE = 16;
 
 private:
+	/// What one pass over the blocks searches
+	struct Pass {
+		/// Planes of the reference frames
+		const ReferencePlanes* refs;
+
+		/// Number of reference frames
+		int num_refs;
+
+		/// Search for the whole-pixel candidates
+		const SearchStrategy* search;
+
+		/// Integral images of the reference planes by reference, or nullptr
+		/// unless the search is exhaustive
+		const std::unique_ptr<IntegralImage>* integrals;
+	};
+
+	/**
+	 * Call process(i, j) for every block, with the block rows spread over the threads
+	 *
+	 * @param[in] wavefront whether a block has to wait for its top-right neighbour,
+	 *   which keeps a row two blocks behind the row above it
+	 * @param[in] process function of the block row and column
+	 */
+	void ForEachBlock(bool wavefront, const std::function<void(int, int)>& process);
+
+	/**
+	 * Predict the vector of a block from its neighbours, the way its difference
+	 * would be coded: the median of the left, top and top-right vectors,
+	 * or the left vector in the first row
+	 *
+	 * @param[in] mvectors vectors of the current frame, complete up to the block
+	 * @param[in] i block row
+	 * @param[in] j block column
+	 */
+	MV GetPredictor(const MotionField& mvectors, int i, int j) const;
+
+	/**
+	 * Collect the seed vectors of a block
+	 *
+	 * The seeds are the zero vector, the global motion vector, the median of
+	 * the left, top and top-right neighbours, the neighbours themselves, the
+	 * co-located vector of the previous frame and the shifts of the block's tile.
+	 *
+	 * @param[in] mvectors vectors of the current frame, complete up to the block
+	 * @param[in] i block row
+	 * @param[in] j block column
+	 */
+	SeedList GetSeeds(const MotionField& mvectors, int i, int j) const;
+
+	/**
+	 * Vector of the global motion model at the center of a block, rounded to
+	 * the precision of the search and kept inside the reference plane.
+	 * Only meaningful if the model is valid.
+	 *
+	 * @param[in] i block row
+	 * @param[in] j block column
+	 */
+	MV GetGlobalVector(int i, int j) const;
+
+	/**
+	 * Choose the search range of a block from the vectors around it
+	 *
+	 * The left, top and top-right vectors and the co-located one of the
+	 * previous frame, scaled to one frame, bound the likely motion. Where they
+	 * are short and agree, the range only just covers them; it grows with their
+	 * spread, and neighbours with a high error or too few of them leave the
+	 * block the full range.
+	 *
+	 * @param[in] mvectors vectors of the current frame, complete up to the block
+	 * @param[in] i block row
+	 * @param[in] j block column
+	 * @return range in pixels, up to the largest range of the search
+	 */
+	int GetSearchRange(const MotionField& mvectors, int i, int j) const;
+
+	/**
+	 * Find an exact copy of a block in the previous frame among the positions
+	 * with its hash nearest to where the predicted vector points. Of the
+	 * copies, the one with the cheapest vector wins.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] prev_Y array of pixels of the previous frame the hashes were matched in
+	 * @param[in] i block row
+	 * @param[in] j block column
+	 * @param[in] pred_x horizontal component of the predicted vector in MV units
+	 * @param[in] pred_y vertical component of the predicted vector in MV units
+	 * @param[out] vector vector of the copy with a zero error, if found
+	 * @return whether a copy was found
+	 */
+	bool FindExactMatch(const uint8_t* cur_Y,
+	                    const uint8_t* prev_Y,
+	                    int i,
+	                    int j,
+	                    int pred_x,
+	                    int pred_y,
+	                    MV& vector) const;
+
+	/**
+	 * Fit the global motion model to the field of the current frame, for the next one,
+	 * and set the SAD up to which blocks follow it
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] prev_planes planes of the previous frame
+	 * @param[in] mvectors vectors of the current frame
+	 */
+	void FitGlobalMotion(const uint8_t* cur_Y, const ReferencePlanes& prev_planes, const MotionField& mvectors);
+
+	/**
+	 * Find coarse vectors on the downsampled frames
+	 *
+	 * Fills coarse_vectors and keeps the pyramid of cur_Y for the next call.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] prev_Y array of pixels of the previous frame
+	 */
+	void EstimateCoarse(const uint8_t* cur_Y, const uint8_t* prev_Y);
+
+	/**
+	 * Find the shifts of every tile of the frame by phase correlation
+	 *
+	 * Fills tile_vectors. Frames smaller than a tile have no tiles.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] prev_Y array of pixels of the previous frame
+	 */
+	void CorrelateTiles(const uint8_t* cur_Y, const uint8_t* prev_Y);
+
+	/**
+	 * Find the vector of a SIZE x SIZE block, then split the block into quarters
+	 * recursively where the quarters with their vectors cost less than the whole block
+	 *
+	 * Blocks with a low cost and 4x4 blocks are not split. The cost of a split
+	 * block is the sum of the costs of its quarters plus the split flag. SIZE is
+	 * 16, 8 or 4, so the searches and metrics below run at a fixed block size.
+	 *
+	 * @param[in] cur_Y array of pixels of the current frame
+	 * @param[in] pass references and search
+	 * @param[in] row row of the block in the extended frame
+	 * @param[in] col column of the block in the extended frame
+	 * @param[in] range search range over the previous frame in pixels,
+	 *   multiplied by the distance for older references
+	 * @param[in] seeds seeds of the pattern searches as motion over one frame,
+	 *   multiplied by the distance for older references
+	 * @param[in] pred_x horizontal component of the predicted vector in MV units
+	 * @param[in] pred_y vertical component of the predicted vector in MV units
+	 * @param[out] mvectors field that receives the vector and the partition of the block
+	 * @param[in] node node of the block in the field
+	 * @param[in] joint whether the exhaustive search should also find the candidates
+	 *   of the quarters over the previous frame, which pays off where the block
+	 *   is likely to be split
+	 * @param[in] searched whole-pixel candidates over the previous frame with their SADs,
+	 *   found together with the parent block, or nullptr to search the block
+	 * @return vector of the block, with the cost of the partition if it is split
+	 */
+	template<int SIZE>
+	MV EstimateBlock(const uint8_t* cur_Y,
+	                 const Pass& pass,
+	                 int row,
+	                 int col,
+	                 int range,
+	                 const SeedList& seeds,
+	                 int pred_x,
+	                 int pred_y,
+	                 MotionField& mvectors,
+	                 int node,
+	                 bool joint = false,
+	                 const CandidateList* searched = nullptr) const;
+
+	/**
+	 * Refine the best whole-pixel candidate to half pixels, then to quarter
+	 * pixels if the quality asks for it. Does nothing without half-pixel precision.
+	 *
+	 * @param[in] block block searched over the whole-pixel plane
+	 * @param[in] planes reference planes by ShiftDir
+	 * @param[in,out] candidates candidates of the whole-pixel search
+	 */
+	void RefineSubpixel(const SearchBlock& block, const uint8_t* const* planes, CandidateList& candidates) const;
+
 	/// Frame width (not including borders)
 	const int width;
 
@@ -68,9 +341,18 @@ private:
 	/// Whether to use half-pixel precision
 	const bool use_half_pixel;
 
+	/// Search settings derived from the quality
+	const SearchParams search_params;
+
+	/// Size of the borders of the frames
+	const int border;
+
 	/// Extended frame width (including borders)
 	const int width_ext;
 
+	/// Extended frame height (including borders)
+	const int height_ext;
+
 	/// Number of blocks per X-axis
 	const int num_blocks_hor;
 
@@ -79,4 +361,66 @@ private:
 
 	/// Position of the first pixel of the frame in the extended frame
 	const int first_row_offset;
+
+	/// Search strategy for the quality
+	std::unique_ptr<SearchStrategy> search;
+
+	/// Small diamond refinement for the finer pyramid levels
+	std::unique_ptr<SearchStrategy> refine;
+
+	/// Hexagon search around the reversed backward vectors for the forward field
+	std::unique_ptr<SearchStrategy> track;
+
+	/// Vectors of the blocks of the previous frame, without their partitions. Empty before the first frame.
+	std::vector<MV> prev_vectors;
+
+	/// Pyramids of the current and the previous frame, swapped after every frame.
+	/// Null unless the search uses the pyramid.
+	std::unique_ptr<Pyramid> cur_pyramid;
+	std::unique_ptr<Pyramid> prev_pyramid;
+
+	/// Vectors found on the pyramid, scaled to the full frame
+	std::vector<SeedList::Seed> coarse_vectors;
+
+	/// Phase correlation of the tiles. Null unless the search uses it.
+	std::unique_ptr<PhaseCorrelation> phase_correlation;
+
+	/// Shifts of the tiles found by phase correlation, in raster order
+	std::vector<SeedList> tile_vectors;
+
+	/// Integral images of the whole-pixel reference planes, by reference.
+	/// Null unless the search is exhaustive.
+	std::unique_ptr<IntegralImage> integrals[MAX_REFERENCES];
+
+	/// Threads searching the block rows
+	std::unique_ptr<ThreadPool> pool;
+
+	/// Number of finished blocks of every row in the current pass
+	std::unique_ptr<std::atomic<int>[]> row_progress;
+
+	/// SADs of the blocks at the zero vector against the previous frame
+	std::unique_ptr<long[]> zero_sads;
+
+	/// Number of blocks of the last frame that took the zero vector without a search
+	int num_static_blocks;
+
+	/// Camera motion fitted to the field of the previous frame
+	GlobalMotion global_motion;
+
+	/// Largest SAD of a block at the global motion vector that takes the vector
+	/// without a search: the typical error of the blocks that followed the camera
+	/// in the previous frame, but at least the static threshold
+	long global_sad;
+
+	/// Number of blocks of the last frame that took the global motion vector without a search
+	int num_global_blocks;
+
+	/// Positions of the previous frame with the hashes of the blocks. Null unless hash matching is on.
+	std::unique_ptr<BlockHashMatcher> hash_matcher;
+
+	/// Number of blocks of the last frame that took an exact copy found by hash
+	int num_hash_blocks;
+
+	/// Average search range of the searched blocks of the last frame
+	double average_range;
 };
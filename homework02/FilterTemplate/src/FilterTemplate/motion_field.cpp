@@ -0,0 +1,10 @@
+#include "motion_field.hpp"
+
+MotionField::MotionField(int num_blocks)
+	: num_blocks(num_blocks)
+	, xs(num_blocks * NODES_PER_BLOCK)
+	, ys(num_blocks * NODES_PER_BLOCK)
+	, errors(num_blocks * NODES_PER_BLOCK)
+	, refs(num_blocks * NODES_PER_BLOCK)
+	, split_masks(num_blocks) {
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "mv.hpp"
+
+/// Motion vectors of a frame with the partitions of its blocks.
+/// Every block owns a fixed quadtree of nodes: the block, its quarters and
+/// their quarters, down to 4x4. The nodes are numbered level by level: the
+/// blocks in raster order, then the quarters of each block in turn, then
+/// theirs. Node i of the first level is block i. Each field of the vectors
+/// has an array of its own, so a frame reuses the same storage, and
+/// reading whole blocks only touches the start of the arrays.
+class MotionField {
+public:
+	/// Size of the blocks in pixels
+	static constexpr int BLOCK_SIZE = 16;
+
+	/// Nodes of the quadtree of a block
+	static constexpr int NODES_PER_BLOCK = 1 + 4 + 16;
+
+	/// Constructor, allocates the nodes of num_blocks blocks, all zero vectors
+	explicit MotionField(int num_blocks = 0);
+
+	/// Number of blocks
+	inline int NumBlocks() const {
+		return num_blocks;
+	}
+
+	/// Vector of a node, without its partition
+	inline MV Get(int node) const {
+		return MV(xs[node], ys[node], errors[node], refs[node]);
+	}
+
+	/// Set the vector of a node, which then covers the node whole
+	inline void Set(int node, const MV& vector) {
+		xs[node] = vector.x;
+		ys[node] = vector.y;
+		errors[node] = vector.error;
+		refs[node] = static_cast<uint8_t>(vector.ref);
+
+		if (node < 5 * num_blocks)
+			split_masks[GetMaskIndex(node)] &= ~GetMaskBit(node);
+	}
+
+	/// Mark a 16x16 or 8x8 node as split; its quarters are the children
+	inline void Split(int node) {
+		assert(node < 5 * num_blocks);
+		split_masks[GetMaskIndex(node)] |= GetMaskBit(node);
+	}
+
+	/// Check if a node is split
+	inline bool IsSplit(int node) const {
+		return node < 5 * num_blocks && (split_masks[GetMaskIndex(node)] & GetMaskBit(node));
+	}
+
+	/// Quarter h of a 16x16 or 8x8 node, in raster order
+	inline int Child(int node, int h) const {
+		assert(node < 5 * num_blocks && h >= 0 && h < 4);
+		return (node < num_blocks) ? num_blocks + 4 * node + h : 5 * num_blocks + 4 * (node - num_blocks) + h;
+	}
+
+	/// The leaf of the partition of a block that covers the pixel (x, y) of the frame
+	inline int GetLeaf(int block, int x, int y) const {
+		// The split mask of the block tells the whole path.
+		const auto mask = split_masks[block];
+		if (!(mask & 1))
+			return block;
+
+		const auto h = (((y % BLOCK_SIZE) < (BLOCK_SIZE / 2)) ? 0 : 2)
+			+ (((x % BLOCK_SIZE) < (BLOCK_SIZE / 2)) ? 0 : 1);
+		const auto quarter = num_blocks + 4 * block + h;
+		if (!(mask & (2 << h)))
+			return quarter;
+
+		const auto sub = (((y % (BLOCK_SIZE / 2)) < (BLOCK_SIZE / 4)) ? 0 : 2)
+			+ (((x % (BLOCK_SIZE / 2)) < (BLOCK_SIZE / 4)) ? 0 : 1);
+		return 5 * num_blocks + 4 * (quarter - num_blocks) + sub;
+	}
+
+private:
+	int num_blocks;
+
+	std::vector<int> xs;
+	std::vector<int> ys;
+	std::vector<long> errors;
+	std::vector<uint8_t> refs;
+
+	/// One byte per block: bit 0 for the block, bits 1 to 4 for its quarters
+	std::vector<uint8_t> split_masks;
+
+	/// Block of a 16x16 or 8x8 node
+	inline int GetMaskIndex(int node) const {
+		return (node < num_blocks) ? node : (node - num_blocks) / 4;
+	}
+
+	/// Bit of a 16x16 or 8x8 node in the split mask of its block
+	inline uint8_t GetMaskBit(int node) const {
+		return (node < num_blocks) ? 1 : static_cast<uint8_t>(2 << ((node - num_blocks) % 4));
+	}
+};
@@ -1,12 +1,9 @@
 #pragma once
 
-#include <array>
-#include <cassert>
 #include <cstdint>
 #include <limits>
-#include <memory>
-#include <utility>
 
+/// Half-pixel phase of a reference plane
 enum class ShiftDir
 {
 	NONE,
@@ -18,83 +15,55 @@ enum class ShiftDir
 class MV
 {
 public:
-	/// Constructor
+	/// Number of fractional bits of the vector components
+	static constexpr int FRACTION_BITS = 2;
+
+	/// One pixel in vector units
+	static constexpr int ONE = 1 << FRACTION_BITS;
+
+	/// Constructor, x and y are in 1/ONE pixel units
 	MV(int x = 0,
 	   int y = 0,
-	   ShiftDir shift_dir = ShiftDir::NONE,
-	   long error = std::numeric_limits<long>::max())
+	   long error = std::numeric_limits<long>::max(),
+	   int ref = 0)
 		: x(x)
 		, y(y)
-		, shift_dir(shift_dir)
 		, error(error)
-		, subvectors(nullptr)
+		, ref(ref)
 	{}
 
-	/// Copy constructor
-	MV(const MV& other)
-		: x(other.x)
-		, y(other.y)
-		, shift_dir(other.shift_dir)
-		, error(other.error)
-	{
-		if (other.subvectors)
-			subvectors = std::make_unique<SubVectors>(*other.subvectors);
-	}
-
-	/// Move constructor
-	MV(MV&& other)
-		: MV()
-	{
-		swap(other);
-	}
-
-	/// Copy + move assignment operator
-	MV& operator=(MV other)
+	/// Horizontal component rounded down to whole pixels
+	inline int IntX() const
 	{
-		swap(other);
-		return *this;
+		return x >> FRACTION_BITS;
 	}
 
-	/// Split into 4 subvectors
-	inline void Split()
+	/// Vertical component rounded down to whole pixels
+	inline int IntY() const
 	{
-		subvectors = std::make_unique<SubVectors>();
+		return y >> FRACTION_BITS;
 	}
 
-	/// Unsplit
-	inline void Unsplit()
+	/// Fractional part of the horizontal component, in vector units
+	inline int FracX() const
 	{
-		subvectors.reset();
+		return x & (ONE - 1);
 	}
 
-	/// Check if the motion vector is split
-	inline bool IsSplit() const
+	/// Fractional part of the vertical component, in vector units
+	inline int FracY() const
 	{
-		return (subvectors != nullptr);
-	}
-
-	/// Get a subvector
-	inline MV& SubVector(int id)
-	{
-		assert(subvectors && id >= 0 && id < 4);
-		return (*subvectors)[id];
+		return y & (ONE - 1);
 	}
 
+	/// Horizontal component in vector units
 	int x;
+
+	/// Vertical component in vector units
 	int y;
-	ShiftDir shift_dir;
-	long error;
 
-private:
-	using SubVectors = std::array<MV, 4>;
-	std::unique_ptr<SubVectors> subvectors;
+	long error;
 
-	void swap(MV& other)
-	{
-		std::swap(x, other.x);
-		std::swap(y, other.y);
-		std::swap(shift_dir, other.shift_dir);
-		std::swap(error, other.error);
-		std::swap(subvectors, other.subvectors);
-	}
+	/// Reference frame, 0 for the previous frame, 1 for the one before it and so on
+	int ref;
 };
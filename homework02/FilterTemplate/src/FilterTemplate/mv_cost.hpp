@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Bit cost of a vector as signed exp-Golomb codes of the difference of its
+// components from the predicted vector, the way H.264 codes vector differences.
+
+/// floor(log2(n)) for n >= 1
+constexpr int FloorLog2(unsigned n) {
+	return (n < 2) ? 0 : 1 + FloorLog2(n / 2);
+}
+
+/// Length of the unsigned exp-Golomb code of k
+constexpr int ExpGolombBits(unsigned k) {
+	return 2 * FloorLog2(k + 1) + 1;
+}
+
+/// Length of the signed exp-Golomb code of v
+constexpr int SignedExpGolombBits(int v) {
+	return ExpGolombBits((v > 0) ? 2u * v - 1 : 2u * -v);
+}
+
+/// Vector component differences with a precomputed length, -MV_BITS_RANGE..MV_BITS_RANGE - 1
+constexpr int MV_BITS_RANGE = 256;
+
+template<std::size_t... I>
+constexpr std::array<uint8_t, sizeof...(I)> MakeMVBitsTable(std::index_sequence<I...>) {
+	return { { static_cast<uint8_t>(SignedExpGolombBits(static_cast<int>(I) - MV_BITS_RANGE))... } };
+}
+
+/// Code lengths of the component differences, indexed by difference + MV_BITS_RANGE
+constexpr std::array<uint8_t, 2 * MV_BITS_RANGE> MV_BITS = MakeMVBitsTable(std::make_index_sequence<2 * MV_BITS_RANGE>());
+
+static_assert(SignedExpGolombBits(0) == 1 && SignedExpGolombBits(1) == 3 && SignedExpGolombBits(-1) == 3
+              && SignedExpGolombBits(2) == 5 && SignedExpGolombBits(-4) == 7, "exp-Golomb lengths");
+
+/// Code length of one vector component difference in MV units
+inline int GetComponentBits(int d) {
+	return (d >= -MV_BITS_RANGE && d < MV_BITS_RANGE) ? MV_BITS[d + MV_BITS_RANGE] : SignedExpGolombBits(d);
+}
+
+/// Code length of a vector difference in MV units
+inline int GetMVBits(int dx, int dy) {
+	return GetComponentBits(dx) + GetComponentBits(dy);
+}
+
+/// Code length of a reference index among num_refs references: none for one reference,
+/// one bit for two, the exp-Golomb code otherwise, as H.264 codes ref_idx
+constexpr int GetRefBits(int ref, int num_refs) {
+	return (num_refs < 2) ? 0 : (num_refs == 2) ? 1 : ExpGolombBits(ref);
+}
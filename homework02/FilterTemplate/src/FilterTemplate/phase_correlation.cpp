@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+
+#include "phase_correlation.hpp"
+
+namespace {
+
+/// Side of the transformed tiles
+constexpr int N = PhaseCorrelation::TILE_SIZE / PhaseCorrelation::SCALE;
+
+/// Peaks lower than this are noise
+constexpr float MIN_PEAK_HEIGHT = 0.05f;
+
+/// Distance around a peak cleared before looking for the next one, in samples
+constexpr int PEAK_RADIUS = 1;
+
+/**
+ * Downsample a tile by summing SCALE x SCALE pixels
+ *
+ * @param[in] tile top-left pixel of the tile
+ * @param[in] stride row stride of the frame
+ * @param[out] sums N x N sums
+ * @return sum of all pixels
+ */
+int Downsample(const uint8_t* tile, int stride, int* sums) {
+	std::fill(sums, sums + N * N, 0);
+
+	for (int y = 0; y < PhaseCorrelation::TILE_SIZE; ++y) {
+		const auto* row = tile + y * stride;
+		auto* dst = sums + (y / PhaseCorrelation::SCALE) * N;
+
+		for (int x = 0; x < N; ++x) {
+			for (int dx = 0; dx < PhaseCorrelation::SCALE; ++dx)
+				dst[x] += row[x * PhaseCorrelation::SCALE + dx];
+		}
+	}
+
+	int total = 0;
+	for (int i = 0; i < N * N; ++i)
+		total += sums[i];
+
+	return total;
+}
+
+/// Offset of the vertex of the parabola through three values from the middle one, in -0.5..0.5
+inline float ParabolaVertex(float left, float middle, float right) {
+	const auto curvature = left - 2 * middle + right;
+	return (curvature < 0) ? std::max(-0.5f, std::min(0.5f, 0.5f * (left - right) / curvature)) : 0.0f;
+}
+
+}
+
+PhaseCorrelation::PhaseCorrelation()
+	: fft(N)
+	, window(N * N) {
+	const auto pi = std::acos(-1.0);
+
+	for (int y = 0; y < N; ++y) {
+		for (int x = 0; x < N; ++x) {
+			const auto wy = 0.5 - 0.5 * std::cos(2 * pi * (y + 0.5) / N);
+			const auto wx = 0.5 - 0.5 * std::cos(2 * pi * (x + 0.5) / N);
+			window[y * N + x] = static_cast<float>(wy * wx);
+		}
+	}
+}
+
+int PhaseCorrelation::FindPeaks(const uint8_t* cur, const uint8_t* prev, int stride, Peak* peaks) const {
+	std::vector<FFT::Complex> data(N * N);
+	std::vector<FFT::Complex> spectrum(N * N);
+
+	// Both real tiles go into one complex transform, the current one as the real part.
+	int cur_sums[N * N];
+	int prev_sums[N * N];
+	const auto cur_mean = static_cast<float>(Downsample(cur, stride, cur_sums)) / (N * N);
+	const auto prev_mean = static_cast<float>(Downsample(prev, stride, prev_sums)) / (N * N);
+
+	for (int i = 0; i < N * N; ++i)
+		data[i] = FFT::Complex((cur_sums[i] - cur_mean) * window[i], (prev_sums[i] - prev_mean) * window[i]);
+
+	fft.Transform2D(data.data(), false);
+
+	// The spectra of the real tiles are the even and the odd parts of the joint one.
+	// Their cross-power spectrum keeps only the phase differences.
+	for (int u = 0; u < N; ++u) {
+		for (int v = 0; v < N; ++v) {
+			const auto z = data[u * N + v];
+			const auto z_mirror = std::conj(data[((N - u) % N) * N + (N - v) % N]);
+			const auto cur_spectrum = (z + z_mirror) * 0.5f;
+			const auto prev_spectrum = (z - z_mirror) * 0.5f;
+
+			// prev_spectrum is i times the spectrum of the previous tile, so the
+			// product with the conjugate current spectrum is rotated by -i back.
+			const auto re = prev_spectrum.real() * cur_spectrum.real() + prev_spectrum.imag() * cur_spectrum.imag();
+			const auto im = prev_spectrum.imag() * cur_spectrum.real() - prev_spectrum.real() * cur_spectrum.imag();
+			const auto norm = re * re + im * im;
+			const auto scale = (norm > 1e-6f) ? 1.0f / std::sqrt(norm) : 0.0f;
+
+			spectrum[u * N + v] = FFT::Complex(im * scale, -re * scale);
+		}
+	}
+
+	fft.Transform2D(spectrum.data(), true);
+
+	std::vector<float> surface(N * N);
+	for (int i = 0; i < N * N; ++i)
+		surface[i] = spectrum[i].real() / (N * N);
+
+	const auto at = [&](int y, int x) {
+		return surface[((y + N) % N) * N + (x + N) % N];
+	};
+
+	int count = 0;
+
+	for (; count < MAX_PEAKS; ++count) {
+		const auto best = std::max_element(surface.begin(), surface.end()) - surface.begin();
+		const auto height = surface[best];
+		if (height < MIN_PEAK_HEIGHT)
+			break;
+
+		// The surface wraps around, shifts past half the tile are negative.
+		const auto y = static_cast<int>(best / N);
+		const auto x = static_cast<int>(best % N);
+		const auto fy = y + ParabolaVertex(at(y - 1, x), height, at(y + 1, x));
+		const auto fx = x + ParabolaVertex(at(y, x - 1), height, at(y, x + 1));
+
+		peaks[count].x = static_cast<int>(std::lround(SCALE * ((fx < N / 2) ? fx : fx - N)));
+		peaks[count].y = static_cast<int>(std::lround(SCALE * ((fy < N / 2) ? fy : fy - N)));
+		peaks[count].height = height;
+
+		for (int dy = -PEAK_RADIUS; dy <= PEAK_RADIUS; ++dy)
+			for (int dx = -PEAK_RADIUS; dx <= PEAK_RADIUS; ++dx)
+				surface[((y + dy + N) % N) * N + (x + dx + N) % N] = 0;
+	}
+
+	return count;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "fft.hpp"
+
+/// Global shifts of frame tiles found by phase correlation.
+/// The normalized cross-power spectrum of two tiles transforms back into
+/// a surface with a sharp peak at every shift between them, however long,
+/// at the cost of two FFTs per tile.
+class PhaseCorrelation {
+public:
+	/// Side of a tile, in pixels of the frame
+	static constexpr int TILE_SIZE = 128;
+
+	/// Tiles are downsampled by this factor before the transform
+	static constexpr int SCALE = 4;
+
+	/// Most peaks reported for a tile
+	static constexpr int MAX_PEAKS = 2;
+
+	/// A shift between two tiles
+	struct Peak {
+		/// Shift in pixels: the current tile at p matches the previous one at p + (x, y)
+		int x, y;
+
+		/// Height of the peak, 1 for tiles that only differ by the shift
+		float height;
+	};
+
+	/// Constructor, precomputes the transform and the window
+	PhaseCorrelation();
+
+	/**
+	 * Find the strongest shifts between a tile of the current frame and the
+	 * co-located tile of the previous one
+	 *
+	 * Shifts reach up to half the tile size either way. Peaks too low to
+	 * stand out from the noise of the surface are dropped.
+	 *
+	 * @param[in] cur top-left pixel of the current tile
+	 * @param[in] prev top-left pixel of the previous tile
+	 * @param[in] stride row stride of both frames
+	 * @param[out] peaks array of MAX_PEAKS peaks, the highest first
+	 * @return number of peaks found
+	 */
+	int FindPeaks(const uint8_t* cur, const uint8_t* prev, int stride, Peak* peaks) const;
+
+private:
+	/// Transform of the downsampled tiles
+	FFT fft;
+
+	/// Separable Hann window that keeps the tile edges from correlating
+	std::vector<float> window;
+};
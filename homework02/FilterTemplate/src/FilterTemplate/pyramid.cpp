@@ -0,0 +1,55 @@
+#include <cstring>
+
+#include "pyramid.hpp"
+
+Pyramid::Pyramid(int width, int height)
+	: built(false) {
+	widths[0] = width;
+	heights[0] = height;
+
+	for (int level = 1; level < LEVELS; ++level) {
+		widths[level] = (widths[level - 1] + 1) / 2;
+		heights[level] = (heights[level - 1] + 1) / 2;
+		levels[level] = std::make_unique<uint8_t[]>(WidthExt(level) * HeightExt(level));
+	}
+}
+
+void Pyramid::Build(const uint8_t* plane, int border) {
+	auto src = plane + border * (widths[0] + 2 * border) + border;
+	auto src_stride = widths[0] + 2 * border;
+
+	for (int level = 1; level < LEVELS; ++level) {
+		const auto stride = WidthExt(level);
+		const auto width = widths[level];
+		const auto height = heights[level];
+		const auto first = levels[level].get() + BORDER * stride + BORDER;
+
+		// 2x2 box filter. Odd frame sizes read one pixel into the border of the finer level.
+		for (int y = 0; y < height; ++y) {
+			const auto row0 = src + 2 * y * src_stride;
+			const auto row1 = row0 + src_stride;
+			auto dst = first + y * stride;
+
+			for (int x = 0; x < width; ++x)
+				dst[x] = static_cast<uint8_t>((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+		}
+
+		// Replicate the edges into the border.
+		for (int y = 0; y < height; ++y) {
+			auto row = first + y * stride;
+			std::memset(row - BORDER, row[0], BORDER);
+			std::memset(row + width, row[width - 1], stride - BORDER - width);
+		}
+
+		for (int y = 0; y < BORDER; ++y)
+			std::memcpy(first - BORDER + (y - BORDER) * stride, first - BORDER, stride);
+
+		for (int y = height; y < HeightExt(level) - BORDER; ++y)
+			std::memcpy(first - BORDER + y * stride, first - BORDER + (height - 1) * stride, stride);
+
+		src = first;
+		src_stride = stride;
+	}
+
+	built = true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+/// Downsampled copies of a frame for hierarchical motion estimation.
+/// Level 0 is the frame itself and is not stored; every next level halves
+/// both dimensions and has its own border of replicated edge pixels.
+class Pyramid {
+public:
+	/// Number of levels, including the full-resolution one
+	static constexpr int LEVELS = 3;
+
+	/// Border of the downsampled levels, in pixels of the level
+	static constexpr int BORDER = 16;
+
+	/// Constructor, allocates the levels for a width x height frame
+	Pyramid(int width, int height);
+
+	/**
+	 * Fill the levels from a frame
+	 *
+	 * @param[in] plane frame with borders of the given size
+	 * @param[in] border border size of the frame
+	 */
+	void Build(const uint8_t* plane, int border);
+
+	/// Width of a level including its borders
+	inline int WidthExt(int level) const {
+		return widths[level] + 2 * BORDER;
+	}
+
+	/// Height of a level including its borders
+	inline int HeightExt(int level) const {
+		return heights[level] + 2 * BORDER;
+	}
+
+	/// Pixels of a level including its borders, level >= 1
+	inline const uint8_t* Level(int level) const {
+		return levels[level].get();
+	}
+
+	/// Whether the pyramid was built from a frame
+	inline bool IsBuilt() const {
+		return built;
+	}
+
+	/// Forget the frame the pyramid was built from
+	inline void Invalidate() {
+		built = false;
+	}
+
+private:
+	/// Level widths, not including borders
+	int widths[LEVELS];
+
+	/// Level heights, not including borders
+	int heights[LEVELS];
+
+	/// Level pixels with borders; the first entry is unused
+	std::unique_ptr<uint8_t[]> levels[LEVELS];
+
+	/// Whether Build() has been called since the last Invalidate()
+	bool built;
+};
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "metric.hpp"
+#include "search.hpp"
+#include "subpel.hpp"
+
+namespace {
+
+/// SAD of a SIZE x SIZE block, SIZE is 16, 8 or 4. 4x4 blocks are too small for early termination.
+template<int SIZE>
+inline long GetErrorSAD(const uint8_t* block1, const uint8_t* block2, int stride, long threshold) {
+	if (SIZE == 16)
+		return GetErrorSAD_16x16(block1, block2, stride, threshold);
+	if (SIZE == 8)
+		return GetErrorSAD_8x8(block1, block2, stride, threshold);
+
+	return Sad<4, 4>(block1, block2, stride);
+}
+
+/// SADs of a SIZE x SIZE block against 8 consecutive reference positions, SIZE is 16, 8 or 4
+template<int SIZE>
+inline void GetErrorSAD_x8(const uint8_t* block1, const uint8_t* block2, int stride, long* errors, long threshold) {
+	if (SIZE == 16) {
+		GetErrorSAD_16x16_x8(block1, block2, stride, errors, threshold);
+	} else if (SIZE == 8) {
+		GetErrorSAD_8x8_x8(block1, block2, stride, errors, threshold);
+	} else {
+		for (int k = 0; k < 8; ++k)
+			errors[k] = Sad<4, 4>(block1, block2 + k, stride);
+	}
+}
+
+struct Offset {
+	int x;
+	int y;
+};
+
+constexpr Offset SMALL_DIAMOND[] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
+
+constexpr Offset LARGE_DIAMOND[] = {
+	{ 0, -2 }, { -1, -1 }, { 1, -1 }, { -2, 0 }, { 2, 0 }, { -1, 1 }, { 1, 1 }, { 0, 2 }
+};
+
+constexpr Offset HEXAGON[] = { { -2, 0 }, { -1, -2 }, { 1, -2 }, { 2, 0 }, { 1, 2 }, { -1, 2 } };
+
+/// Points of the UMH multi-hexagon grid at scale 1
+constexpr Offset HEXAGON_16[] = {
+	{ -4, -2 }, { -4, -1 }, { -4, 0 }, { -4, 1 }, { -4, 2 },
+	{ 4, -2 }, { 4, -1 }, { 4, 0 }, { 4, 1 }, { 4, 2 },
+	{ -2, -3 }, { 0, -4 }, { 2, -3 }, { -2, 3 }, { 0, 4 }, { 2, 3 }
+};
+
+/// Weight of the vector bits at quality 100
+constexpr int LAMBDA_MIN = 1;
+
+/// Weight of the vector bits at quality 0
+constexpr int LAMBDA_MAX = 8;
+
+/// Zero-vector SAD of a 16x16 block up to which it is static at quality 100,
+/// one per pixel, about the level of mild sensor noise
+constexpr long STATIC_SAD_MIN = 256;
+
+/// Zero-vector SAD of a 16x16 block up to which it is static at quality 0, three per pixel
+constexpr long STATIC_SAD_MAX = 768;
+
+/// Evaluates vectors of one SIZE x SIZE block and tracks the best of them
+template<int SIZE>
+class Probe {
+public:
+	Probe(const SearchBlock& block, CandidateList& candidates)
+		: block(block)
+		, candidates(candidates)
+		, best_x(0)
+		, best_y(0)
+		, best_error(std::numeric_limits<long>::max()) {
+	}
+
+	/// Evaluate a vector; invalid vectors are ignored
+	inline void Try(int x, int y) {
+		if (x < block.min_x || x > block.max_x || y < block.min_y || y > block.max_y)
+			return;
+
+		// An early-terminated SAD exceeds both bounds, and the cost is at least
+		// the SAD, so the vector can neither become the best nor enter the list.
+		const auto threshold = std::max(best_error, candidates.Threshold());
+		const auto error = GetErrorSAD<SIZE>(block.cur, block.prev + y * block.stride + x, block.stride, threshold)
+		                   + GetMVCost(block, x * MV::ONE, y * MV::ONE);
+
+		candidates.Add(x * MV::ONE, y * MV::ONE, error);
+
+		if (error < best_error) {
+			best_x = x;
+			best_y = y;
+			best_error = error;
+		}
+	}
+
+	/// Evaluate the seeds of the block
+	inline void TrySeeds() {
+		if (!block.seeds) {
+			Try(0, 0);
+			return;
+		}
+
+		for (int i = 0; i < block.seeds->count; ++i)
+			Try(block.seeds->items[i].x, block.seeds->items[i].y);
+	}
+
+	/// Evaluate the points of a pattern around (x, y)
+	template<size_t N>
+	inline void TryPattern(const Offset (&pattern)[N], int x, int y, int scale = 1) {
+		for (const auto& offset : pattern)
+			Try(x + offset.x * scale, y + offset.y * scale);
+	}
+
+	/// Move the pattern to its best point until the center stays the best
+	template<size_t N>
+	inline void Iterate(const Offset (&pattern)[N], int max_iterations) {
+		for (int i = 0; i < max_iterations; ++i) {
+			const auto x = best_x;
+			const auto y = best_y;
+
+			TryPattern(pattern, x, y);
+
+			if (best_x == x && best_y == y)
+				break;
+		}
+	}
+
+	const SearchBlock& block;
+	CandidateList& candidates;
+
+	int best_x;
+	int best_y;
+	long best_error;
+};
+
+/// A strategy whose search is instantiated for every block size. The size is
+/// dispatched once per search, and the evaluation of every vector calls the
+/// kernels of that size directly.
+template<typename Strategy>
+class SizedSearch : public SearchStrategy {
+public:
+	void Search(const SearchBlock& block, CandidateList& candidates) const override {
+		const auto& strategy = static_cast<const Strategy&>(*this);
+
+		switch (block.size) {
+		case 16:
+			strategy.template SearchSized<16>(block, candidates);
+			break;
+		case 8:
+			strategy.template SearchSized<8>(block, candidates);
+			break;
+		default:
+			strategy.template SearchSized<4>(block, candidates);
+			break;
+		}
+	}
+};
+
+/// Every vector in the range
+class ExhaustiveSearch : public SizedSearch<ExhaustiveSearch> {
+public:
+	/// Candidates whose quadrant-sum lower bound already reaches the worst cost
+	/// kept by the list are skipped; the bound is below the SAD and so below the cost,
+	/// and the list ends up the same as without pruning.
+	template<int SIZE>
+	void SearchSized(const SearchBlock& block, CandidateList& candidates) const {
+		const auto min_x = std::max(-block.range, block.min_x);
+		const auto max_x = std::min(block.range, block.max_x);
+		const auto min_y = std::max(-block.range, block.min_y);
+		const auto max_y = std::min(block.range, block.max_y);
+
+		for (int y = min_y; y <= max_y; ++y) {
+			const auto prev_row = block.prev + y * block.stride;
+			int x = min_x;
+
+			for (; x + 8 <= max_x + 1; x += 8) {
+				const auto threshold = candidates.Threshold();
+
+				if (block.integral->GetCandidateMask_x8(block.row + y, block.col + x, SIZE, block.cur_sums, threshold) == 0)
+					continue;
+
+				long errors[8];
+				GetErrorSAD_x8<SIZE>(block.cur, prev_row + x, block.stride, errors, threshold);
+
+				for (int k = 0; k < 8; ++k)
+					candidates.Add((x + k) * MV::ONE, y * MV::ONE, errors[k] + GetMVCost(block, (x + k) * MV::ONE, y * MV::ONE));
+			}
+
+			for (; x <= max_x; ++x) {
+				if (block.integral->GetQuadrantBound(block.row + y, block.col + x, SIZE, block.cur_sums) < candidates.Threshold())
+					candidates.Add(x * MV::ONE,
+					               y * MV::ONE,
+					               GetErrorSAD<SIZE>(block.cur, prev_row + x, block.stride, candidates.Threshold())
+					               + GetMVCost(block, x * MV::ONE, y * MV::ONE));
+			}
+		}
+	}
+};
+
+/// Small diamond, large diamond or hexagon descent from the best seed,
+/// followed by small diamond refinement
+class PatternSearch : public SizedSearch<PatternSearch> {
+public:
+	PatternSearch(SearchPattern pattern, int max_iterations, int refinement)
+		: pattern(pattern)
+		, max_iterations(max_iterations)
+		, refinement(refinement) {
+	}
+
+	template<int SIZE>
+	void SearchSized(const SearchBlock& block, CandidateList& candidates) const {
+		Probe<SIZE> probe(block, candidates);
+		probe.TrySeeds();
+
+		switch (pattern) {
+		case SearchPattern::LARGE_DIAMOND:
+			probe.Iterate(LARGE_DIAMOND, max_iterations);
+			break;
+		case SearchPattern::HEXAGON:
+			probe.Iterate(HEXAGON, max_iterations);
+			break;
+		default:
+			probe.Iterate(SMALL_DIAMOND, max_iterations);
+			break;
+		}
+
+		probe.Iterate(SMALL_DIAMOND, refinement);
+	}
+
+private:
+	const SearchPattern pattern;
+	const int max_iterations;
+	const int refinement;
+};
+
+/// Uneven multi-hexagon search, a simplified form of the x264 UMH
+class UMHSearch : public SizedSearch<UMHSearch> {
+public:
+	UMHSearch(int max_iterations, int refinement)
+		: max_iterations(max_iterations)
+		, refinement(refinement) {
+	}
+
+	template<int SIZE>
+	void SearchSized(const SearchBlock& block, CandidateList& candidates) const {
+		const auto range = block.range;
+
+		Probe<SIZE> probe(block, candidates);
+		probe.TrySeeds();
+
+		// Unsymmetrical cross, horizontal motion is the more common one
+		auto x = probe.best_x;
+		auto y = probe.best_y;
+
+		for (int d = 2; d <= range; d += 2) {
+			probe.Try(x - d, y);
+			probe.Try(x + d, y);
+		}
+
+		for (int d = 2; d <= range / 2; d += 2) {
+			probe.Try(x, y - d);
+			probe.Try(x, y + d);
+		}
+
+		// 5x5 full search around the best point
+		x = probe.best_x;
+		y = probe.best_y;
+
+		for (int dy = -2; dy <= 2; ++dy)
+			for (int dx = -2; dx <= 2; ++dx)
+				probe.Try(x + dx, y + dy);
+
+		// Multi-hexagon grid of growing scale
+		x = probe.best_x;
+		y = probe.best_y;
+
+		for (int scale = 1; scale * 4 <= range; ++scale)
+			probe.TryPattern(HEXAGON_16, x, y, scale);
+
+		probe.Iterate(HEXAGON, max_iterations);
+		probe.Iterate(SMALL_DIAMOND, refinement);
+	}
+
+private:
+	const int max_iterations;
+	const int refinement;
+};
+
+/// Offer a candidate to a list ranked by SAD. Of equal SADs the vector
+/// nearer the predictor of the block is kept, as the cost would keep it.
+inline void AddNearest(const SearchBlock& block, CandidateList& candidates, int x, int y, long error) {
+	const auto bits = GetMVBits(x - block.pred_x, y - block.pred_y);
+	const auto is_worse = [&](const CandidateList::Candidate& item) {
+		return item.error > error
+		       || (item.error == error && GetMVBits(item.x - block.pred_x, item.y - block.pred_y) > bits);
+	};
+
+	if (candidates.count == candidates.capacity && !is_worse(candidates.items[candidates.count - 1]))
+		return;
+
+	int i = (candidates.count < candidates.capacity) ? candidates.count++ : candidates.count - 1;
+	for (; i > 0 && is_worse(candidates.items[i - 1]); --i)
+		candidates.items[i] = candidates.items[i - 1];
+
+	candidates.items[i] = { x, y, error };
+}
+
+/// SearchJoint for a SIZE x SIZE block
+template<int SIZE>
+void SearchJointSized(const SearchBlock& block, CandidateList& candidates, CandidateList* quarters) {
+	constexpr auto half = SIZE / 2;
+	const auto min_x = std::max(-block.range, block.min_x);
+	const auto max_x = std::min(block.range, block.max_x);
+	const auto min_y = std::max(-block.range, block.min_y);
+	const auto max_y = std::min(block.range, block.max_y);
+
+	int quarter_offsets[4];
+	long quarter_sums[4][4];
+
+	for (int h = 0; h < 4; ++h) {
+		quarter_offsets[h] = ((h > 1) ? half * block.stride : 0) + ((h & 1) ? half : 0);
+		GetQuadrantSums(block.cur + quarter_offsets[h], block.stride, half, quarter_sums[h]);
+	}
+
+	// Whether a candidate can still enter the list of the block or of a quarter.
+	// A quarter candidate that ties the worst one may still replace it.
+	const auto is_needed_x8 = [&](int y, int x) {
+		if (block.integral->GetCandidateMask_x8(block.row + y, block.col + x, SIZE, block.cur_sums, candidates.Threshold()))
+			return true;
+
+		for (int h = 0; h < 4; ++h) {
+			const auto row = block.row + y + ((h > 1) ? half : 0);
+			const auto col = block.col + x + ((h & 1) ? half : 0);
+			const auto threshold = quarters[h].Threshold();
+
+			if (block.integral->GetCandidateMask_x8(row,
+			                                        col,
+			                                        half,
+			                                        quarter_sums[h],
+			                                        (threshold < std::numeric_limits<long>::max()) ? threshold + 1 : threshold))
+				return true;
+		}
+
+		return false;
+	};
+
+	for (int y = min_y; y <= max_y; ++y) {
+		const auto prev_row = block.prev + y * block.stride;
+
+		for (int x = min_x; x <= max_x; x += 8) {
+			const auto count = std::min(8, max_x + 1 - x);
+
+			if (count == 8 && !is_needed_x8(y, x))
+				continue;
+
+			// Quarter SADs run to completion, since they add up to the SAD of the block.
+			long errors[4][8];
+			if (count == 8 && SIZE == 16) {
+				GetErrorSAD_16x16_Quadrants_x8(block.cur, prev_row + x, block.stride, errors);
+			} else {
+				for (int h = 0; h < 4; ++h) {
+					const auto cur = block.cur + quarter_offsets[h];
+					const auto prev = prev_row + x + quarter_offsets[h];
+
+					if (count == 8) {
+						GetErrorSAD_x8<half>(cur, prev, block.stride, errors[h], std::numeric_limits<long>::max());
+					} else {
+						for (int k = 0; k < count; ++k)
+							errors[h][k] = GetErrorSAD<half>(cur, prev + k, block.stride, std::numeric_limits<long>::max());
+					}
+				}
+			}
+
+			for (int k = 0; k < count; ++k) {
+				const auto mv_x = (x + k) * MV::ONE;
+				const auto mv_y = y * MV::ONE;
+
+				candidates.Add(mv_x, mv_y, errors[0][k] + errors[1][k] + errors[2][k] + errors[3][k] + GetMVCost(block, mv_x, mv_y));
+
+				for (int h = 0; h < 4; ++h)
+					AddNearest(block, quarters[h], mv_x, mv_y, errors[h][k]);
+			}
+		}
+	}
+}
+
+/// RefineSubpixel for a SIZE x SIZE block
+template<int SIZE>
+void RefineSubpixelSized(const SearchBlock& block, const uint8_t* const* planes, int step, CandidateList& candidates) {
+	const auto center = candidates.items[0];
+	const auto offset = block.row * block.stride + block.col;
+
+	for (int dy = -step; dy <= step; dy += step) {
+		for (int dx = -step; dx <= step; dx += step) {
+			const auto x = center.x + dx;
+			const auto y = center.y + dy;
+
+			// Both interpolated samples must lie in the plane.
+			if ((dx == 0 && dy == 0)
+			    || x < block.min_x * MV::ONE || x > block.max_x * MV::ONE
+			    || y < block.min_y * MV::ONE || y > block.max_y * MV::ONE)
+				continue;
+
+			const auto threshold = candidates.Threshold();
+			const auto sad = [&](const uint8_t* block1, const uint8_t* block2, int stride) {
+				return GetErrorSAD<SIZE>(block1, block2, stride, threshold);
+			};
+
+			candidates.Add(x, y, GetSubpelError<SIZE>(sad, block.cur, planes, offset, block.stride, x, y) + GetMVCost(block, x, y));
+		}
+	}
+}
+
+}
+
+void SearchJoint(const SearchBlock& block, CandidateList& candidates, CandidateList* quarters) {
+	// Only blocks that can be split have quarters.
+	if (block.size == 16)
+		SearchJointSized<16>(block, candidates, quarters);
+	else
+		SearchJointSized<8>(block, candidates, quarters);
+}
+
+void SearchSeeds(const SearchBlock& block, CandidateList& candidates) {
+	switch (block.size) {
+	case 16:
+		Probe<16>(block, candidates).TrySeeds();
+		break;
+	case 8:
+		Probe<8>(block, candidates).TrySeeds();
+		break;
+	default:
+		Probe<4>(block, candidates).TrySeeds();
+		break;
+	}
+}
+
+void RefineSubpixel(const SearchBlock& block, const uint8_t* const* planes, int step, CandidateList& candidates) {
+	switch (block.size) {
+	case 16:
+		RefineSubpixelSized<16>(block, planes, step, candidates);
+		break;
+	case 8:
+		RefineSubpixelSized<8>(block, planes, step, candidates);
+		break;
+	default:
+		RefineSubpixelSized<4>(block, planes, step, candidates);
+		break;
+	}
+}
+
+SearchParams GetSearchParams(uint8_t quality, int max_range) {
+	const auto iterations = 4 + quality / 8;
+	const auto lambda = LAMBDA_MIN + (100 - quality) * (LAMBDA_MAX - LAMBDA_MIN) / 100;
+	const auto static_sad = STATIC_SAD_MIN + (100 - quality) * (STATIC_SAD_MAX - STATIC_SAD_MIN) / 100;
+
+	if (quality >= 90)
+		return { SearchPattern::EXHAUSTIVE, 0, 0, true, false, true, true, lambda, static_sad, max_range };
+	if (quality >= 70)
+		return { SearchPattern::UMH, iterations, 2, true, true, true, true, lambda, static_sad, max_range };
+	if (quality >= 50)
+		return { SearchPattern::HEXAGON, iterations, 1, true, true, true, true, lambda, static_sad, max_range };
+	if (quality >= 30)
+		return { SearchPattern::LARGE_DIAMOND, iterations, 1, false, true, false, false, lambda, static_sad, max_range };
+
+	return { SearchPattern::SMALL_DIAMOND, iterations, 0, false, true, false, false, lambda, static_sad, max_range };
+}
+
+std::unique_ptr<SearchStrategy> CreateSearchStrategy(const SearchParams& params) {
+	switch (params.pattern) {
+	case SearchPattern::EXHAUSTIVE:
+		return std::make_unique<ExhaustiveSearch>();
+	case SearchPattern::UMH:
+		return std::make_unique<UMHSearch>(params.max_iterations, params.refinement);
+	default:
+		return std::make_unique<PatternSearch>(params.pattern, params.max_iterations, params.refinement);
+	}
+}
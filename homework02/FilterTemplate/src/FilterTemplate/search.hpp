@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include "integral_image.hpp"
+#include "mv.hpp"
+#include "mv_cost.hpp"
+
+/// Most candidates a CandidateList can hold
+constexpr int MAX_CANDIDATES = 4;
+
+/// The best few candidates of a search, sorted by cost. Vectors are in MV units.
+/// Candidates with equal cost keep the order in which they were found.
+class CandidateList {
+public:
+	explicit CandidateList(int capacity)
+		: capacity(capacity)
+		, count(0) {
+	}
+
+	/// Largest error that can still enter the list
+	inline long Threshold() const {
+		return (count < capacity) ? std::numeric_limits<long>::max() : items[count - 1].error;
+	}
+
+	inline void Add(int x, int y, long error) {
+		if (count == capacity && error >= items[count - 1].error)
+			return;
+
+		// Pattern searches may visit a vector twice, with the same error both times
+		for (int i = 0; i < count && items[i].error <= error; ++i) {
+			if (items[i].x == x && items[i].y == y)
+				return;
+		}
+
+		int i = (count < capacity) ? count++ : count - 1;
+		for (; i > 0 && items[i - 1].error > error; --i)
+			items[i] = items[i - 1];
+
+		items[i] = { x, y, error };
+	}
+
+	struct Candidate {
+		int x;
+		int y;
+		long error;
+	};
+
+	const int capacity;
+	int count;
+	Candidate items[MAX_CANDIDATES];
+};
+
+/// Most seeds a SeedList can hold
+constexpr int MAX_SEEDS = 12;
+
+/// Integer vectors a pattern search starts from, without duplicates
+class SeedList {
+public:
+	SeedList()
+		: count(0) {
+	}
+
+	inline void Add(int x, int y) {
+		for (int i = 0; i < count; ++i) {
+			if (items[i].x == x && items[i].y == y)
+				return;
+		}
+
+		if (count < MAX_SEEDS)
+			items[count++] = { x, y };
+	}
+
+	struct Seed {
+		int x;
+		int y;
+	};
+
+	int count;
+	Seed items[MAX_SEEDS];
+};
+
+/// A block searched over one reference plane
+struct SearchBlock {
+	/// Current block
+	const uint8_t* cur;
+
+	/// Reference block at the zero vector on the whole-pixel plane
+	const uint8_t* prev;
+
+	/// Row stride of both planes
+	int stride;
+
+	/// Block size, 16, 8 or 4
+	int size;
+
+	/// Extent of the search around its start: the exhaustive search covers
+	/// vectors with components up to range, UMH sizes its cross and grid by it
+	int range;
+
+	/// Smallest valid horizontal vector component, in pixels
+	int min_x;
+
+	/// Largest valid horizontal vector component, in pixels
+	int max_x;
+
+	/// Smallest valid vertical vector component, in pixels
+	int min_y;
+
+	/// Largest valid vertical vector component, in pixels
+	int max_y;
+
+	/// Vectors the pattern searches start from, the zero vector if null.
+	/// The search continues from the best of them.
+	const SeedList* seeds;
+
+	/// Integral image of the reference plane, only used by the exhaustive search
+	const IntegralImage* integral;
+
+	/// Quadrant sums of the current block, only used by the exhaustive search
+	const long* cur_sums;
+
+	/// Row of the block in the extended frame
+	int row;
+
+	/// Column of the block in the extended frame
+	int col;
+
+	/// Predicted vector in MV units, the rate term counts the bits of the difference from it
+	int pred_x;
+	int pred_y;
+
+	/// Weight of the vector bits against the SAD, 0 to rank by SAD alone
+	int lambda;
+};
+
+/// Rate term of the cost of a vector in MV units
+inline long GetMVCost(const SearchBlock& block, int x, int y) {
+	return block.lambda * GetMVBits(x - block.pred_x, y - block.pred_y);
+}
+
+enum class SearchPattern {
+	EXHAUSTIVE,
+	SMALL_DIAMOND,
+	LARGE_DIAMOND,
+	HEXAGON,
+	UMH
+};
+
+/// Search settings derived from the quality
+struct SearchParams {
+	SearchPattern pattern;
+
+	/// Most steps of the iterative pattern
+	int max_iterations;
+
+	/// Small diamond steps after the main pattern
+	int refinement;
+
+	/// Whether to pick the final vectors and make the split decision by SATD instead of SAD
+	bool use_satd;
+
+	/// Whether to seed the search with vectors found on downsampled frames
+	bool use_pyramid;
+
+	/// Whether to seed the search with tile shifts found by phase correlation,
+	/// which reach past the range of the search
+	bool use_phase_correlation;
+
+	/// Whether to refine half-pixel vectors to quarter pixels
+	bool use_quarter_pixel;
+
+	/// Weight of the vector bits in the cost of a vector
+	int lambda;
+
+	/// Largest SAD of a 16x16 block at the zero or the global motion vector that takes
+	/// that vector without a search
+	long static_sad;
+
+	/// Largest search range in pixels. Blocks among short, consistent vectors search less.
+	int max_range;
+};
+
+/**
+ * Map the quality to search settings
+ *
+ * Quality 90 and above keeps the exhaustive search; lower values trade
+ * accuracy for speed with successively cheaper patterns, seeded from
+ * the frame pyramid. From quality 50 up, tile shifts found by phase
+ * correlation add long-range seeds. Lower values also weight the vector bits more,
+ * which keeps the field smooth where the SAD is flat, and let blocks
+ * with more change count as static.
+ *
+ * @param[in] quality quality in 0..100
+ * @param[in] max_range largest search range in pixels
+ */
+SearchParams GetSearchParams(uint8_t quality, int max_range);
+
+/// Strategy for finding the candidate vectors of a block
+class SearchStrategy {
+public:
+	virtual ~SearchStrategy() = default;
+
+	/**
+	 * Search a block over one reference plane
+	 *
+	 * @param[in] block block and reference plane
+	 * @param[in,out] candidates best candidates found so far; every evaluated
+	 *   vector is offered to the list with its cost, SAD + lambda * bits
+	 */
+	virtual void Search(const SearchBlock& block, CandidateList& candidates) const = 0;
+};
+
+/**
+ * Search a block and its four quarters over every vector in the range in one pass
+ *
+ * The SAD of the block at each vector is the sum of the SADs of its quarters,
+ * so the reference window is read once for all five. Candidates are skipped
+ * where the quadrant-sum bounds rule them out for the block and every quarter.
+ *
+ * @param[in] block block and reference plane; the integral image is required
+ * @param[in,out] candidates candidates of the block, ranked by cost
+ * @param[in,out] quarters candidate lists of the quarters in raster order, ranked by SAD,
+ *   since their predicted vector is the final vector of the block; of equal SADs the
+ *   vector nearer the predictor of the block is kept
+ */
+void SearchJoint(const SearchBlock& block, CandidateList& candidates, CandidateList* quarters);
+
+/**
+ * Evaluate the seeds of a block at whole pixels
+ *
+ * @param[in] block block and reference plane with its seeds, the zero vector if there are none
+ * @param[in,out] candidates candidates found so far; the seeds are offered to the list with their cost
+ */
+void SearchSeeds(const SearchBlock& block, CandidateList& candidates);
+
+/**
+ * Evaluate the 8 neighbours of the best candidate at a sub-pixel step
+ *
+ * @param[in] block block searched over the whole-pixel plane
+ * @param[in] planes reference planes with borders, indexed by ShiftDir
+ * @param[in] step distance to the neighbours in MV units, MV::ONE / 2 or MV::ONE / 4
+ * @param[in,out] candidates candidates found so far; the neighbours are offered to the list
+ */
+void RefineSubpixel(const SearchBlock& block, const uint8_t* const* planes, int step, CandidateList& candidates);
+
+/// Create the search strategy for the given settings
+std::unique_ptr<SearchStrategy> CreateSearchStrategy(const SearchParams& params);
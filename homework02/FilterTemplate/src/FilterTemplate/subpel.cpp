@@ -0,0 +1,60 @@
+#include <cstring>
+
+#include "cpu.hpp"
+#include "subpel.hpp"
+
+#if defined(ME_X86)
+#include <emmintrin.h>
+
+template<int SIZE>
+ME_TARGET_SSE2
+static void AverageBlocks_SSE2(const uint8_t* block1, const uint8_t* block2, int stride, uint8_t* dst) {
+	if (SIZE == 16) {
+		for (int y = 0; y < 16; ++y) {
+			const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block1 + y * stride));
+			const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block2 + y * stride));
+			_mm_store_si128(reinterpret_cast<__m128i*>(dst + y * 16), _mm_avg_epu8(a, b));
+		}
+	} else if (SIZE == 8) {
+		for (int y = 0; y < 8; ++y) {
+			const auto a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block1 + y * stride));
+			const auto b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block2 + y * stride));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + y * 8), _mm_avg_epu8(a, b));
+		}
+	} else {
+		for (int y = 0; y < 4; ++y) {
+			int32_t a, b;
+			std::memcpy(&a, block1 + y * stride, 4);
+			std::memcpy(&b, block2 + y * stride, 4);
+
+			const auto avg = _mm_cvtsi128_si32(_mm_avg_epu8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b)));
+			std::memcpy(dst + y * 4, &avg, 4);
+		}
+	}
+}
+
+static const bool use_sse2 = GetCpuFeatures().sse2;
+#endif
+
+template<int SIZE>
+void AverageBlocks(const uint8_t* block1, const uint8_t* block2, int stride, uint8_t* dst) {
+#if defined(ME_X86)
+	if (use_sse2) {
+		AverageBlocks_SSE2<SIZE>(block1, block2, stride, dst);
+		return;
+	}
+#endif
+
+	for (int y = 0; y < SIZE; ++y) {
+		for (int x = 0; x < SIZE; ++x)
+			dst[x] = static_cast<uint8_t>((block1[x] + block2[x] + 1) >> 1);
+
+		block1 += stride;
+		block2 += stride;
+		dst += SIZE;
+	}
+}
+
+template void AverageBlocks<16>(const uint8_t*, const uint8_t*, int, uint8_t*);
+template void AverageBlocks<8>(const uint8_t*, const uint8_t*, int, uint8_t*);
+template void AverageBlocks<4>(const uint8_t*, const uint8_t*, int, uint8_t*);
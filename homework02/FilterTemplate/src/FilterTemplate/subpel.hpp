@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "mv.hpp"
+
+// Vectors are in quarter pixels. Samples on the half-pixel grid come from the
+// four half-pixel planes; a quarter-pixel sample is the rounded average of the
+// two nearest half-pixel-grid samples, the diagonal ones when both vector
+// components are odd.
+
+static_assert(MV::FRACTION_BITS == 2, "sub-pixel sampling expects quarter-pixel vectors");
+
+/// A sample of the half-pixel grid: plane and whole-pixel position in it
+struct HalfGridSample {
+	ShiftDir plane;
+	int x;
+	int y;
+};
+
+/// The sample at (hx / 2, hy / 2) pixels of the half-pixel grid
+inline HalfGridSample GetHalfGridSample(int hx, int hy) {
+	static constexpr ShiftDir phases[2][2] = {
+		{ ShiftDir::NONE, ShiftDir::LEFT },
+		{ ShiftDir::UP, ShiftDir::UPLEFT }
+	};
+
+	return { phases[hy & 1][hx & 1], hx >> 1, hy >> 1 };
+}
+
+/**
+ * Find the two half-pixel-grid samples averaged for a vector
+ *
+ * @param[in] x horizontal vector component in MV units
+ * @param[in] y vertical vector component in MV units
+ * @param[out] a first sample
+ * @param[out] b second sample, equal to a for vectors on the half-pixel grid
+ */
+inline void GetSubpelSources(int x, int y, HalfGridSample& a, HalfGridSample& b) {
+	a = GetHalfGridSample(x >> 1, y >> 1);
+	b = GetHalfGridSample((x + 1) >> 1, (y + 1) >> 1);
+}
+
+/// Whether a vector lies on the half-pixel grid
+inline bool IsOnHalfGrid(int x, int y) {
+	return ((x | y) & 1) == 0;
+}
+
+/**
+ * Compute the rounded average of two SIZE x SIZE blocks
+ *
+ * Instantiated for the block sizes 16, 8 and 4.
+ *
+ * @param[in] block1 first block
+ * @param[in] block2 second block
+ * @param[in] stride row stride of both blocks
+ * @param[out] dst SIZE x SIZE output with row stride SIZE
+ */
+template<int SIZE>
+void AverageBlocks(const uint8_t* block1, const uint8_t* block2, int stride, uint8_t* dst);
+
+extern template void AverageBlocks<16>(const uint8_t*, const uint8_t*, int, uint8_t*);
+extern template void AverageBlocks<8>(const uint8_t*, const uint8_t*, int, uint8_t*);
+extern template void AverageBlocks<4>(const uint8_t*, const uint8_t*, int, uint8_t*);
+
+/**
+ * Copy a SIZE x SIZE block into a packed array
+ *
+ * @param[in] block block to copy
+ * @param[in] stride row stride of the block
+ * @param[out] dst SIZE x SIZE output with row stride SIZE
+ */
+template<int SIZE>
+inline void CopyBlock(const uint8_t* block, int stride, uint8_t* dst) {
+	for (int y = 0; y < SIZE; ++y)
+		std::memcpy(dst + y * SIZE, block + y * stride, SIZE);
+}
+
+/**
+ * Compute an error metric of a SIZE x SIZE block against the reference block
+ * at a sub-pixel vector
+ *
+ * @param[in] metric function of (block1, block2, stride) for SIZE x SIZE blocks
+ * @param[in] cur current block
+ * @param[in] planes reference planes with borders, indexed by ShiftDir
+ * @param[in] offset position of the block in the planes
+ * @param[in] stride row stride of the current frame and the planes
+ * @param[in] x horizontal vector component in MV units
+ * @param[in] y vertical vector component in MV units
+ */
+template<int SIZE, typename Metric>
+long GetSubpelError(Metric metric,
+                    const uint8_t* cur,
+                    const uint8_t* const* planes,
+                    int offset,
+                    int stride,
+                    int x,
+                    int y) {
+	HalfGridSample a, b;
+	GetSubpelSources(x, y, a, b);
+
+	const auto ref_a = planes[static_cast<int>(a.plane)] + offset + a.y * stride + a.x;
+
+	if (IsOnHalfGrid(x, y))
+		return metric(cur, ref_a, stride);
+
+	// Quarter-pixel samples are interpolated into packed blocks.
+	alignas(16) uint8_t packed_cur[SIZE * SIZE];
+	alignas(16) uint8_t packed_ref[SIZE * SIZE];
+
+	const auto ref_b = planes[static_cast<int>(b.plane)] + offset + b.y * stride + b.x;
+	AverageBlocks<SIZE>(ref_a, ref_b, stride, packed_ref);
+	CopyBlock<SIZE>(cur, stride, packed_cur);
+
+	return metric(packed_cur, packed_ref, SIZE);
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(int num_threads)
+	: job(nullptr)
+	, count(0)
+	, next(0)
+	, busy(0)
+	, generation(0)
+	, stop(false) {
+	if (num_threads <= 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 1; i < num_threads; ++i)
+		workers.emplace_back(&ThreadPool::Work, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+
+	start.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::Run(int count, const std::function<void(int)>& job) {
+	if (workers.empty() || count <= 1) {
+		for (int i = 0; i < count; ++i)
+			job(i);
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->job = &job;
+		this->count = count;
+		next = 0;
+		busy = static_cast<int>(workers.size());
+		++generation;
+	}
+
+	start.notify_all();
+	Drain();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busy == 0; });
+	this->job = nullptr;
+}
+
+void ThreadPool::Drain() {
+	for (int i = next++; i < count; i = next++)
+		(*job)(i);
+}
+
+void ThreadPool::Work() {
+	unsigned seen = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start.wait(lock, [&] { return stop || generation != seen; });
+
+			if (stop)
+				return;
+
+			seen = generation;
+		}
+
+		Drain();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busy == 0)
+			done.notify_one();
+	}
+}
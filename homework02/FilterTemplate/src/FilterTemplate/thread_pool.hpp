@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads that run indexed jobs together with the calling thread.
+/// Indices are handed out in increasing order, so a job may wait for jobs with
+/// smaller indices without deadlocking.
+class ThreadPool {
+public:
+	/**
+	 * Constructor, starts the workers
+	 *
+	 * @param[in] num_threads number of threads including the caller,
+	 *   0 for one per hardware thread
+	 */
+	explicit ThreadPool(int num_threads);
+
+	/// Destructor, stops the workers
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// Number of threads including the caller
+	inline int Size() const {
+		return static_cast<int>(workers.size()) + 1;
+	}
+
+	/**
+	 * Run job(index) for every index in 0..count-1 and wait for all of them
+	 *
+	 * @param[in] count number of jobs
+	 * @param[in] job function of the job index
+	 */
+	void Run(int count, const std::function<void(int)>& job);
+
+private:
+	/// Take indices of the current run until none are left
+	void Drain();
+
+	/// Worker loop
+	void Work();
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+
+	/// Signalled when a run starts or the pool stops
+	std::condition_variable start;
+
+	/// Signalled when the last worker leaves a run
+	std::condition_variable done;
+
+	/// Job of the current run
+	const std::function<void(int)>* job;
+
+	/// Number of jobs of the current run
+	int count;
+
+	/// Next index to hand out
+	std::atomic<int> next;
+
+	/// Workers that have not finished the current run
+	int busy;
+
+	/// Incremented for every run, so that workers notice a new one
+	unsigned generation;
+
+	bool stop;
+};